@@ -20,6 +20,42 @@ struct UserStabData {
 	const char *stabstr_end;
 };
 
+// Kernel symbol tables, built from the kernel's stabs by kdebug_init()
+// so that debuginfo_eip() on a kernel address is two binary searches
+// over compact sorted arrays instead of three passes over the stabs.
+// User addresses still go through the stabs, which differ per env.
+#define NKSYMFN		2048
+#define NKSYMLINE	12288
+#define NKSYMFILE	512
+#define NKSYMCACHE	64		// must be a power of 2
+
+struct KsymFn {
+	uintptr_t kf_addr;
+	uintptr_t kf_end;		// first address past the function
+	const char *kf_name;		// not null terminated
+	uint16_t kf_namelen;
+	uint16_t kf_narg;
+};
+
+struct KsymLine {
+	uintptr_t kl_addr;
+	uint16_t kl_line;
+	uint16_t kl_file;		// index into ksym_files
+};
+
+static struct KsymFn ksym_fns[NKSYMFN];
+static struct KsymLine ksym_lines[NKSYMLINE];
+static const char *ksym_files[NKSYMFILE];
+static int ksym_nfn, ksym_nline, ksym_nfile;
+static bool ksym_ready;			// tables complete; else use the stabs
+
+// Recent kernel lookups, direct-mapped by address.
+static struct {
+	uintptr_t kc_addr;		// 0 if empty
+	int kc_r;			// debuginfo_eip() result
+	struct Eipdebuginfo kc_info;
+} ksym_cache[NKSYMCACHE];
+
 
 // stab_binsearch(stabs, region_left, region_right, type, addr)
 //
@@ -104,6 +140,157 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 }
 
 
+// Index of file name 'name' in ksym_files, adding it if it's new.
+// Returns -1 if the table is full.
+static int
+ksym_file(const char *name)
+{
+	int i;
+
+	for (i = ksym_nfile - 1; i >= 0; i--)
+		if (ksym_files[i] == name)
+			return i;
+	if (ksym_nfile == NKSYMFILE)
+		return -1;
+	ksym_files[ksym_nfile] = name;
+	return ksym_nfile++;
+}
+
+// kdebug_init()
+//
+//	Build the kernel function and line tables from the kernel's stabs.
+//	Called once at boot.  If the stabs don't fit in the tables,
+//	debuginfo_eip() keeps using the stabs for kernel addresses too.
+//
+void
+kdebug_init(void)
+{
+	const struct Stab *s;
+	const char *stabstr = __STABSTR_BEGIN__;
+	const char *name;
+	struct KsymFn *fn = NULL;	// function we're in, if any
+	int file, i, j;
+
+	if (__STABSTR_END__ <= stabstr || __STABSTR_END__[-1] != 0)
+		return;
+	if ((file = ksym_file("<unknown>")) < 0)
+		return;
+
+	for (s = __STAB_BEGIN__; s < __STAB_END__; s++) {
+		if (s->n_strx >= __STABSTR_END__ - stabstr)
+			continue;
+		name = stabstr + s->n_strx;
+
+		switch (s->n_type) {
+		case N_SO:
+		case N_SOL:
+			// A new source file (N_SO) or included file (N_SOL).
+			if (s->n_type == N_SO)
+				fn = NULL;
+			if (*name && (file = ksym_file(name)) < 0)
+				return;
+			break;
+
+		case N_FUN:
+			if (!*name) {
+				// End of the function; n_value is its size.
+				if (fn)
+					fn->kf_end = fn->kf_addr + s->n_value;
+				fn = NULL;
+				break;
+			}
+			if (ksym_nfn == NKSYMFN)
+				return;
+			fn = &ksym_fns[ksym_nfn++];
+			fn->kf_addr = s->n_value;
+			fn->kf_end = 0;
+			fn->kf_name = name;
+			fn->kf_namelen = strfind(name, ':') - name;
+			fn->kf_narg = 0;
+			while (s + 1 < __STAB_END__ && s[1].n_type == N_PSYM) {
+				fn->kf_narg++;
+				s++;
+			}
+			break;
+
+		case N_SLINE:
+			// Relative to the function's start inside a function,
+			// absolute outside (in assembly files).
+			if (ksym_nline == NKSYMLINE)
+				return;
+			ksym_lines[ksym_nline].kl_addr = s->n_value + (fn ? fn->kf_addr : 0);
+			ksym_lines[ksym_nline].kl_line = s->n_desc;
+			ksym_lines[ksym_nline].kl_file = file;
+			ksym_nline++;
+			break;
+		}
+	}
+
+	// The stabs are almost in address order already, so insertion
+	// sort is cheap.
+	for (i = 1; i < ksym_nfn; i++) {
+		struct KsymFn f = ksym_fns[i];
+		for (j = i; j > 0 && ksym_fns[j - 1].kf_addr > f.kf_addr; j--)
+			ksym_fns[j] = ksym_fns[j - 1];
+		ksym_fns[j] = f;
+	}
+	for (i = 1; i < ksym_nline; i++) {
+		struct KsymLine l = ksym_lines[i];
+		for (j = i; j > 0 && ksym_lines[j - 1].kl_addr > l.kl_addr; j--)
+			ksym_lines[j] = ksym_lines[j - 1];
+		ksym_lines[j] = l;
+	}
+
+	// Functions without an end marker end where the next one starts.
+	for (i = 0; i < ksym_nfn; i++)
+		if (!ksym_fns[i].kf_end)
+			ksym_fns[i].kf_end = (i + 1 < ksym_nfn) ? ksym_fns[i + 1].kf_addr : ~0;
+
+	ksym_ready = 1;
+}
+
+// Index of the last of the 'n' entries of 'table', sorted by member
+// 'field', whose 'field' is <= addr, or -1 if there is none.
+#define KSYM_BINSEARCH(table, n, field, addr) ({			\
+	int __l = 0, __r = (n) - 1, __m;				\
+	while (__l <= __r) {						\
+		__m = (__l + __r) / 2;					\
+		if ((table)[__m].field <= (addr))			\
+			__l = __m + 1;					\
+		else							\
+			__r = __m - 1;					\
+	}								\
+	__r;								\
+})
+
+// debuginfo_eip() for a kernel address, from the tables.
+static int
+ksym_lookup(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	struct KsymFn *fn = NULL;
+	struct KsymLine *line;
+	int i;
+
+	i = KSYM_BINSEARCH(ksym_fns, ksym_nfn, kf_addr, addr);
+	if (i >= 0 && addr < ksym_fns[i].kf_end) {
+		fn = &ksym_fns[i];
+		info->eip_fn_name = fn->kf_name;
+		info->eip_fn_namelen = fn->kf_namelen;
+		info->eip_fn_addr = fn->kf_addr;
+		info->eip_fn_narg = fn->kf_narg;
+	}
+
+	i = KSYM_BINSEARCH(ksym_lines, ksym_nline, kl_addr, addr);
+	if (i < 0)
+		return -1;
+	line = &ksym_lines[i];
+	if (fn && line->kl_addr < fn->kf_addr)
+		return -1;	// function has no line info
+	info->eip_line = line->kl_line;
+	info->eip_file = ksym_files[line->kl_file];
+	return 0;
+}
+
 // debuginfo_eip(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
@@ -126,6 +313,19 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_addr = addr;
 	info->eip_fn_narg = 0;
 
+	// Kernel addresses: use the tables, through the cache.
+	if (addr >= ULIM && ksym_ready) {
+		int slot = (addr ^ (addr >> 6)) & (NKSYMCACHE - 1);
+
+		if (ksym_cache[slot].kc_addr != addr) {
+			ksym_cache[slot].kc_r = ksym_lookup(addr, info);
+			ksym_cache[slot].kc_info = *info;
+			ksym_cache[slot].kc_addr = addr;
+		}
+		*info = ksym_cache[slot].kc_info;
+		return ksym_cache[slot].kc_r;
+	}
+
 	// Find the relevant set of stabs
 	if (addr >= ULIM) {
 		stabs = __STAB_BEGIN__;
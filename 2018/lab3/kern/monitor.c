@@ -32,7 +32,11 @@ static struct Command commands[] = {
 	{ "memdump", "Dump the contents of a range of memory given either a virtual or physical address range.", mon_memdump},
 	{ "showpg", "Display useful information of physical pages.", mon_showpg},
 	{ "stepi", "Single-step one instruction. Can only be used when the kernel monitor is invoked via the breakpoint exception.", mon_stepi},
-	{ "continue", "Resume normal execution from stepi.", mon_continue}
+	{ "continue", "Resume normal execution from stepi.", mon_continue},
+	{ "ipcstat", "Display per-pair IPC counts and latency percentiles, or the recent IPC trace.", mon_ipcstat},
+	{ "prof", "Turn the sampling profiler on or off, display the hottest kernel functions, or dump sampled call stacks in folded format.", mon_prof},
+	{ "ktrace", "Dump recent kernel trace events, optionally of one type or env, or enable and disable event types.", mon_ktrace},
+	{ "sysstat", "Display per-system-call counts, errors and cycles.", mon_sysstat}
 };
 
 /***** Implementations of basic kernel monitor commands *****/
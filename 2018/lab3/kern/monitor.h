@@ -21,5 +21,9 @@ int mon_memdump(int argc, char **argv, struct Trapframe *tf);
 int mon_showpg(int argc, char **argv, struct Trapframe *tf);
 int mon_stepi(int argc, char **argv, struct Trapframe *tf);
 int mon_continue(int argc, char **argv, struct Trapframe *tf);
+int mon_ipcstat(int argc, char **argv, struct Trapframe *tf);
+int mon_prof(int argc, char **argv, struct Trapframe *tf);
+int mon_ktrace(int argc, char **argv, struct Trapframe *tf);
+int mon_sysstat(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -14,6 +14,7 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/kdebug.h>
 
 static void boot_aps(void);
 
@@ -27,6 +28,9 @@ i386_init(void)
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	// Index the kernel's stabs for debuginfo_eip()
+	kdebug_init();
+
 	// Lab 2 memory management initialization functions
 	mem_init();
 
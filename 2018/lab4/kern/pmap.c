@@ -5,11 +5,13 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/vdso.h>
 
 #include <kern/pmap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/ktrace.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -18,6 +20,7 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 // These variables are set in mem_init()
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
+struct Vdso *vdso;		// Page mapped read-only at UVDSO
 static struct PageInfo *page_free_list;	// Free list of physical pages
 
 
@@ -166,6 +169,11 @@ mem_init(void)
 	envs = (struct Env *) boot_alloc(NENV * sizeof(struct Env));
 	memset(envs, 0, NENV * sizeof(struct Env));
 
+	//////////////////////////////////////////////////////////////////////
+	// Allocate the page shared with every environment at UVDSO.
+	vdso = (struct Vdso *) boot_alloc(PGSIZE);
+	memset(vdso, 0, PGSIZE);
+
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
 	// up the list of free physical pages. Once we've done so, all further
@@ -203,6 +211,13 @@ mem_init(void)
 	boot_map_region(kern_pgdir, UENVS, NENV*sizeof(struct Env), PADDR(envs), PTE_U);
 	boot_map_region(kern_pgdir, (uintptr_t)envs, NENV*sizeof(struct Env), PADDR(envs), PTE_W);
 
+	//////////////////////////////////////////////////////////////////////
+	// Map the vDSO page read-only by the user at UVDSO, in the unused
+	// tail of the UENVS page table (see inc/vdso.h).  env_setup_vm
+	// copies that page table, so every env gets this mapping too.
+	static_assert(NENV * sizeof(struct Env) <= UVDSO - UENVS);
+	boot_map_region(kern_pgdir, UVDSO, PGSIZE, PADDR(vdso), PTE_U);
+
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
 	// stack.  The kernel stack grows down from virtual address KSTACKTOP.
@@ -384,6 +399,7 @@ page_alloc(int alloc_flags)
 		memset((struct PageInfo *) page2kva(result), 0, PGSIZE);
 	}
 
+	TRACE(KT_PAGE_ALLOC, page2pa(result), alloc_flags);
 	return result;
 }
 
@@ -405,6 +421,7 @@ page_free(struct PageInfo *pp)
 		panic("page_free: invalid free!\n");
 	}
 
+	TRACE(KT_PAGE_FREE, page2pa(pp), 0);
 	pp->pp_link = page_free_list;
 	page_free_list = pp;
 }
@@ -913,6 +930,9 @@ check_kern_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
 
+	// check vDSO page
+	assert(check_va2pa(pgdir, UVDSO) == PADDR(vdso));
+
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
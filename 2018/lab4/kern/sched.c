@@ -4,6 +4,7 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/ktrace.h>
 
 void sched_halt(void);
 
@@ -13,6 +14,8 @@ sched_yield(void)
 {
 	struct Env *idle;
 
+	TRACE(KT_SCHED, curenv ? curenv->env_id : 0, 0);
+
 	// Implement simple round-robin scheduling.
 	//
 	// Search through 'envs' for an ENV_RUNNABLE environment in
@@ -56,11 +59,17 @@ sched_halt(void)
 
 	// For debugging and testing purposes, if there are no runnable
 	// environments in the system, then drop into the kernel monitor.
+	// Environments waiting for a timeout or a notification count as
+	// runnable: the timer or a device interrupt will wake them, so
+	// halt and wait for that instead.
 	for (i = 0; i < NENV; i++) {
 		if ((envs[i].env_status == ENV_RUNNABLE ||
 		     envs[i].env_status == ENV_RUNNING ||
 		     envs[i].env_status == ENV_DYING))
 			break;
+		if (envs[i].env_status == ENV_NOT_RUNNABLE &&
+		    (envs[i].env_timeout || envs[i].env_notify_mask))
+			break;
 	}
 	if (i == NENV) {
 		cprintf("No runnable environments in the system!\n");
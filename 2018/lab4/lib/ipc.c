@@ -25,10 +25,20 @@ int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 {
 	// LAB 4: Your code here.
+	return ipc_recv_until(from_env_store, pg, perm_store, 0);
+}
+
+// Like ipc_recv, but give up and return -E_TIMEOUT if nothing arrives
+// before sys_time_usec() reaches 'deadline'.  A deadline of 0 means wait
+// forever.
+int32_t
+ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+	       uint64_t deadline)
+{
 	void *dstva = (pg) ? pg : (void *)(-1);	// -1 if we don't want to receive a page
 	int rc;
 	
-	if ((rc = sys_ipc_recv(dstva)) < 0) {
+	if ((rc = sys_ipc_recv_until(dstva, deadline)) < 0) {
 		if (from_env_store)
 			*from_env_store = 0;
 		if (perm_store)
@@ -71,6 +81,56 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 	}
 }
 
+// Like ipc_recv, but willing to receive up to 'npages' pages into the
+// window starting at 'pg'.
+// If 'npages_store' is nonnull, then store the number of pages actually
+// mapped at 'pg' in *npages_store (0 if no page was transferred).
+int32_t
+ipc_recv_range(envid_t *from_env_store, void *pg, size_t npages,
+	       int *perm_store, size_t *npages_store)
+{
+	void *dstva = (pg) ? pg : (void *)(-1);	// -1 if we don't want to receive pages
+	int rc;
+
+	if ((rc = sys_ipc_recv_range(dstva, npages)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		if (npages_store)
+			*npages_store = 0;
+		return rc;
+	}
+
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	if (npages_store)
+		*npages_store = thisenv->env_ipc_npages;
+	return (thisenv->env_ipc_value);
+}
+
+// Like ipc_send, but grant the 'npages' contiguous pages starting at 'pg'.
+// The receiver gets as many of them as fit in the window it declared.
+void
+ipc_send_range(envid_t to_env, uint32_t val, void *pg, size_t npages, int perm)
+{
+	void *srcva = (pg) ? pg : (void *)(-1);	// -1 if we don't want to send pages
+	int rc;
+
+	for (;;) {
+		rc = sys_ipc_try_send_range(to_env, val, srcva, npages, perm);
+		if (rc == 0)
+			break;
+		if (rc == -E_IPC_NOT_RECV) {
+			sys_yield();
+			continue;
+		}
+		panic("ipc_send_range: received unexpected return code form sys_ipc_try_send_range: %e\n", rc);
+	}
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
@@ -83,3 +143,81 @@ ipc_find_env(enum EnvType type)
 			return envs[i].env_id;
 	return 0;
 }
+
+// Call endpoint 'epid' with 'val' and, if 'pg' is nonnull, the page at
+// 'pg'.  Wait for the reply and return its value.  If 'rcv_pg' is
+// nonnull, a page sent with the reply is mapped there.
+int32_t
+ep_call(int32_t epid, uint32_t val, void *pg, int perm, void *rcv_pg)
+{
+	void *srcva = (pg) ? pg : (void *)(-1);
+	void *dstva = (rcv_pg) ? rcv_pg : (void *)(-1);
+
+	return sys_ep_call(epid, val, srcva, perm, dstva);
+}
+
+// Receive the next call on endpoint 'epid', like ipc_recv.
+// *from_env_store is the capability to pass to ep_reply.
+// If 'block' is clear, returns -E_TIMEOUT when no call is waiting.
+static int32_t
+ep_recv_common(int32_t epid, void *pg, envid_t *from_env_store, int *perm_store,
+	       bool block)
+{
+	void *dstva = (pg) ? pg : (void *)(-1);
+	int rc;
+
+	rc = block ? sys_ep_recv(epid, dstva) : sys_ep_try_recv(epid, dstva);
+	if (rc < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return rc;
+	}
+
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+int32_t
+ep_recv(int32_t epid, void *pg, envid_t *from_env_store, int *perm_store)
+{
+	return ep_recv_common(epid, pg, from_env_store, perm_store, 1);
+}
+
+// Like ep_recv, but returns -E_TIMEOUT right away if no call is waiting.
+// The endpoint's owner gets NOTIFY_IPC when a call queues up, so it can
+// wait for calls and other events at once with sys_notify_wait.
+int32_t
+ep_try_recv(int32_t epid, void *pg, envid_t *from_env_store, int *perm_store)
+{
+	return ep_recv_common(epid, pg, from_env_store, perm_store, 0);
+}
+
+// Reply to the call received from 'caller'.  A caller that has died
+// in the meantime is silently ignored.
+void
+ep_reply(envid_t caller, int32_t val, void *pg, int perm)
+{
+	void *srcva = (pg) ? pg : (void *)(-1);
+	int rc;
+
+	if ((rc = sys_ep_reply(caller, val, srcva, perm)) < 0 && rc != -E_BAD_ENV)
+		panic("ep_reply: sys_ep_reply: %e", rc);
+}
+
+// Find the endpoint served by the first environment of the given type.
+// Returns 0 if there is no such environment, or it hasn't created its
+// endpoint yet.
+int32_t
+ep_find(enum EnvType type)
+{
+	int i;
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_type == type && envs[i].env_status != ENV_FREE)
+			return envs[i].env_ep;
+	return 0;
+}
@@ -1,13 +1,62 @@
 
 #include "fs.h"
 
+// The block cache holds at most BC_MAXBLOCKS evictable blocks.  Every
+// block bc_pgfault reads in takes a slot in bc_slots; once they are all
+// in use, bc_clock picks a block to drop.  The superblock and the
+// bitmap blocks are pinned: they never take a slot and are never
+// evicted.
+static uint32_t bc_slots[BC_MAXBLOCKS];	// block number held by each slot
+static int bc_nslots;			// slots handed out so far
+static int bc_hand;			// next slot the clock looks at
+
+// Dirty blocks.  A clean block is mapped read-only, so the first write
+// to it faults, and bc_pgfault maps it writable and adds it here.
+// Writing a block back maps it read-only again.  So PTE_W is the dirty
+// bit, and bc_dirty lists exactly the writable blocks, oldest first.
+static struct BcDirty {
+	uint32_t bd_blockno;
+	uint32_t bd_since;	// sys_time_msec() of the first write
+} bc_dirty[BC_MAXDIRTY];
+static int bc_ndirty;
+
+static struct BcStat bcstat;
+
+#define BLOCKVA(blockno)	((void *) (DISKMAP + (blockno) * BLKSIZE))
+
+// Asynchronous reads.  At most one is in flight, going into pages at
+// BCIOVA rather than straight into DISKMAP, so nothing can see a block
+// before its contents have arrived; bc_io_poll() moves them into place.
+#define BCIOVA		0x0e000000
+static uint32_t bcio_blockno;	// first block being read
+static uint32_t bcio_n;		// number of blocks, 0 if none in flight
+static bool bcio_ra;		// read ahead, rather than for a request
+
+// A block that was read ahead is being looked up for the first time.
+static void
+bc_ra_used(void *addr)
+{
+	int r;
+
+	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL & ~PTE_RA)) < 0)
+		panic("in bc_ra_used, sys_page_map: %e", r);
+	bcstat.bs_ra_hits++;
+}
+
 // Return the virtual address of this disk block.
 void*
 diskaddr(uint32_t blockno)
 {
 	if (blockno == 0 || (super && blockno >= super->s_nblocks))
 		panic("bad block number %08x in diskaddr", blockno);
-	return (char*) (DISKMAP + blockno * BLKSIZE);
+	// Every access to a block goes through here first, so this is
+	// where we can tell a hit from the miss bc_pgfault will count.
+	if (va_is_mapped(BLOCKVA(blockno))) {
+		bcstat.bs_hits++;
+		if (uvpt[PGNUM(BLOCKVA(blockno))] & PTE_RA)
+			bc_ra_used(BLOCKVA(blockno));
+	}
+	return BLOCKVA(blockno);
 }
 
 // Is this virtual address mapped?
@@ -18,10 +67,352 @@ va_is_mapped(void *va)
 }
 
 // Is this virtual address dirty?
+// Blocks are only writable while dirty; see bc_dirty.
 bool
 va_is_dirty(void *va)
 {
-	return (uvpt[PGNUM(va)] & PTE_D) != 0;
+	return (uvpt[PGNUM(va)] & PTE_W) != 0;
+}
+
+// Is this block pinned in the cache?  The superblock and the bitmap
+// are reached through 'super' and 'bitmap' all the time.
+static bool
+bc_pinned(uint32_t blockno)
+{
+	if (blockno == 1)
+		return 1;
+	return super && blockno >= 2
+		&& blockno < 2 + ROUNDUP(super->s_nblocks, BLKBITSIZE) / BLKBITSIZE;
+}
+
+// Is this one of the bitmap blocks?
+static bool
+bc_is_bitmap(uint32_t blockno)
+{
+	return blockno >= 2 && bc_pinned(blockno);
+}
+
+// Drop a block from a full cache and return its slot, using the CLOCK
+// algorithm.  The hardware sets PTE_A whenever a block is touched; the
+// hand clears it as it goes by and evicts the first block it finds
+// that hasn't been touched since the last time around.  Dirty blocks
+// are written back before they go.
+static int
+bc_clock(void)
+{
+	void *addr;
+	int slot, r;
+
+	while (1) {
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % BC_MAXBLOCKS;
+		addr = BLOCKVA(bc_slots[slot]);
+
+		if (!va_is_mapped(addr))
+			return slot;
+
+		if (!(uvpt[PGNUM(addr)] & PTE_A)) {
+			flush_block(addr);
+			if (uvpt[PGNUM(addr)] & PTE_RA)
+				bcstat.bs_ra_waste++;
+			if ((r = sys_page_unmap(0, addr)) < 0)
+				panic("in bc_clock, sys_page_unmap: %e", r);
+			bcstat.bs_evictions++;
+			return slot;
+		}
+
+		if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+			panic("in bc_clock, sys_page_map: %e", r);
+	}
+}
+
+// Find a slot for a block that is about to be read in, evicting
+// another block if the cache is full.
+static void
+bc_track(uint32_t blockno)
+{
+	int slot;
+
+	if (bc_nslots < BC_MAXBLOCKS)
+		slot = bc_nslots++;
+	else
+		slot = bc_clock();
+	bc_slots[slot] = blockno;
+}
+
+// Start reading the blocks in [blockno, blockno + n) without waiting,
+// stopping early at the first one that is already in the cache.  The
+// disk must be idle.  Returns the number of blocks started, or < 0 if
+// there is no DMA or it couldn't be started.
+static int
+bc_io_start(uint32_t blockno, uint32_t n, bool ra)
+{
+	uint32_t i;
+	int r;
+
+	assert(bcio_n == 0 && n <= RA_MAXBLOCKS);
+	for (i = 0; i < n; i++) {
+		if (bc_pinned(blockno + i) || va_is_mapped(BLOCKVA(blockno + i)))
+			break;
+		if ((r = sys_page_alloc(0, (void *) (BCIOVA + i * PGSIZE), PTE_P|PTE_U|PTE_W)) < 0)
+			panic("in bc_io_start, sys_page_alloc: %e", r);
+	}
+	if (i == 0)
+		return 0;
+
+	if ((r = ide_dma_start(blockno * BLKSECTS, (void *) BCIOVA, i * BLKSECTS, 0)) < 0) {
+		while (i-- > 0)
+			sys_page_unmap(0, (void *) (BCIOVA + i * PGSIZE));
+		return r;
+	}
+	sys_ktrace(ra ? KTU_BC_READAHEAD : KTU_BC_PGFAULT, blockno);
+	bcio_blockno = blockno;
+	bcio_n = i;
+	bcio_ra = ra;
+	return i;
+}
+
+// Check on the asynchronous read, if any.  If it has finished, move its
+// blocks into DISKMAP.  Returns 1 if no read is in flight any more.
+bool
+bc_io_poll(void)
+{
+	uint32_t blockno, n, i;
+	int r, perm;
+
+	if (bcio_n == 0)
+		return 1;
+	if (!ide_dma_done(&r))
+		return 0;
+	if (r < 0)
+		panic("bc_io_poll: reading blocks %08x-%08x failed",
+		      bcio_blockno, bcio_blockno + bcio_n - 1);
+
+	// Mark the read finished first: bc_track() may have to write back
+	// a dirty block to make room, and that waits for the disk.
+	blockno = bcio_blockno;
+	n = bcio_n;
+	bcio_n = 0;
+
+	for (i = 0; i < n; i++) {
+		void *stage = (void *) (BCIOVA + i * PGSIZE);
+
+		// Unless somebody read it synchronously in the meantime
+		if (!va_is_mapped(BLOCKVA(blockno + i))) {
+			perm = PTE_P|PTE_U | (bcio_ra ? PTE_RA : 0);
+			bc_track(blockno + i);
+			if ((r = sys_page_map(0, stage, 0, BLOCKVA(blockno + i), perm)) < 0)
+				panic("in bc_io_poll, sys_page_map: %e", r);
+		}
+		sys_page_unmap(0, stage);
+	}
+	if (bcio_ra)
+		bcstat.bs_ra_blocks += n;
+	return 1;
+}
+
+// Wait for the asynchronous read, if any, to finish.  Everything that
+// uses the disk synchronously has to do this first.
+static void
+bc_io_wait(void)
+{
+	while (!bc_io_poll())
+		/* do nothing */;
+}
+
+// Is this block in the cache?
+bool
+bc_resident(uint32_t blockno)
+{
+	return va_is_mapped(BLOCKVA(blockno));
+}
+
+// Start bringing 'blockno' into the cache without waiting for it.
+// The caller should wait for bc_io_poll() to report the disk idle and
+// then look again: by then the block has usually arrived, or else the
+// disk was busy with something else and it's time to ask again.
+//
+// Returns 0 if the caller should wait, or -E_NOT_SUPP if reads can't
+// be done asynchronously and it should just go ahead and fault.
+int
+bc_fetch(uint32_t blockno)
+{
+	int r;
+
+	if (bcio_n > 0)
+		return 0;
+	if ((r = bc_io_start(blockno, 1, 0)) < 0)
+		return r;
+	bcstat.bs_misses++;
+	return 0;
+}
+
+// Map a block that was just written back read-only again, keeping the
+// software bits (PTE_RA) as they are.
+static void
+bc_clean(uint32_t blockno)
+{
+	void *addr = BLOCKVA(blockno);
+	int r;
+
+	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL & ~PTE_W)) < 0)
+		panic("in bc_clean, sys_page_map: %e", r);
+}
+
+// Write 'n' blocks out and make them clean.  They are sorted first,
+// so that runs of consecutive blocks, which are consecutive in DISKMAP
+// too, go out in one command.
+static void
+bc_write_sorted(uint32_t *blocks, int n)
+{
+	uint32_t b;
+	int i, j, len;
+
+	// Insertion sort; n is at most BC_MAXDIRTY
+	for (i = 1; i < n; i++) {
+		b = blocks[i];
+		for (j = i; j > 0 && blocks[j - 1] > b; j--)
+			blocks[j] = blocks[j - 1];
+		blocks[j] = b;
+	}
+
+	for (i = 0; i < n; i += len) {
+		if (!va_is_mapped(BLOCKVA(blocks[i]))) {
+			len = 1;	// somebody unmapped it behind our back
+			continue;
+		}
+		// RA_MAXBLOCKS is also the most one IDE command can carry
+		for (len = 1; i + len < n && len < RA_MAXBLOCKS; len++)
+			if (blocks[i + len] != blocks[i] + len
+			    || !va_is_mapped(BLOCKVA(blocks[i + len])))
+				break;
+		ide_write(blocks[i] * BLKSECTS, BLOCKVA(blocks[i]), len * BLKSECTS);
+		for (j = 0; j < len; j++)
+			bc_clean(blocks[i + j]);
+		bcstat.bs_writebacks += len;
+		bcstat.bs_writeruns++;
+	}
+}
+
+// Write back the 'n' blocks in 'blocks', which have already been taken
+// off bc_dirty.  Every dirty bitmap block goes out with them, and
+// ahead of them: anything written back may point at blocks allocated
+// since the bitmap last went out, and the bitmap on disk has to show
+// those as in use first.
+static void
+bc_write_blocks(uint32_t *blocks, int n)
+{
+	static uint32_t bmblocks[BC_MAXDIRTY];
+	int i, nbm = 0;
+
+	for (i = 0; i < bc_ndirty; ) {
+		if (!bc_is_bitmap(bc_dirty[i].bd_blockno)) {
+			i++;
+			continue;
+		}
+		bmblocks[nbm++] = bc_dirty[i].bd_blockno;
+		memmove(&bc_dirty[i], &bc_dirty[i + 1], (bc_ndirty - i - 1) * sizeof(bc_dirty[0]));
+		bc_ndirty--;
+	}
+	for (i = 0; i < n; ) {
+		if (!bc_is_bitmap(blocks[i])) {
+			i++;
+			continue;
+		}
+		bmblocks[nbm++] = blocks[i];
+		blocks[i] = blocks[--n];
+	}
+
+	bc_io_wait();
+	bc_write_sorted(bmblocks, nbm);
+	bc_write_sorted(blocks, n);
+}
+
+// Write back the 'n' blocks that have been dirty the longest.
+static void
+bc_writeback(int n)
+{
+	static uint32_t blocks[BC_MAXDIRTY];
+	int i;
+
+	n = MIN(n, bc_ndirty);
+	for (i = 0; i < n; i++)
+		blocks[i] = bc_dirty[i].bd_blockno;
+	memmove(&bc_dirty[0], &bc_dirty[n], (bc_ndirty - n) * sizeof(bc_dirty[0]));
+	bc_ndirty -= n;
+	bc_write_blocks(blocks, n);
+}
+
+// The background flusher, run from the server loop.  Writes back the
+// blocks that have been dirty for BC_DIRTY_AGE milliseconds, and, if
+// more than BC_DIRTY_HIGH blocks are dirty, the oldest ones until only
+// BC_DIRTY_LOW are.  Returns how many milliseconds until the oldest
+// remaining dirty block gets old enough, or 0 if there is none.
+uint32_t
+bc_writeback_aged(void)
+{
+	uint32_t now;
+	int n;
+
+	if (bc_ndirty == 0)
+		return 0;
+
+	now = sys_time_msec();
+	for (n = 0; n < bc_ndirty; n++)
+		if (now - bc_dirty[n].bd_since < BC_DIRTY_AGE)
+			break;
+	if (bc_ndirty > BC_DIRTY_HIGH)
+		n = MAX(n, bc_ndirty - BC_DIRTY_LOW);
+	if (n > 0)
+		bc_writeback(n);
+
+	if (bc_ndirty == 0)
+		return 0;
+	return MAX(BC_DIRTY_AGE - (now - bc_dirty[0].bd_since), 1);
+}
+
+// A clean block is being written to for the first time: make it
+// writable and remember that it's dirty.  If too many blocks are dirty
+// already, write back the older half of them first.
+//
+// sys_page_map won't make a read-only page writable, so this does what
+// fork's copy-on-write handler does and moves the block to a fresh page.
+static void
+bc_dirtied(uint32_t blockno)
+{
+	void *addr = BLOCKVA(blockno);
+	int r;
+
+	if (bc_ndirty == BC_MAXDIRTY)
+		bc_writeback(BC_MAXDIRTY / 2);
+
+	if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("in bc_dirtied, sys_page_alloc: %e", r);
+	memmove(PFTEMP, addr, BLKSIZE);
+	if ((r = sys_page_map(0, PFTEMP, 0, addr, (uvpt[PGNUM(addr)] & PTE_SYSCALL) | PTE_W)) < 0)
+		panic("in bc_dirtied, sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, PFTEMP)) < 0)
+		panic("in bc_dirtied, sys_page_unmap: %e", r);
+	bc_dirty[bc_ndirty].bd_blockno = blockno;
+	bc_dirty[bc_ndirty].bd_since = sys_time_msec();
+	bc_ndirty++;
+}
+
+// Write back the dirty blocks for which match(blockno, arg) is true,
+// all in one batch, and keep the rest dirty in the same order.
+void
+bc_flush_if(bool (*match)(uint32_t blockno, void *arg), void *arg)
+{
+	static uint32_t blocks[BC_MAXDIRTY];
+	int i, j, n = 0;
+
+	for (i = j = 0; i < bc_ndirty; i++)
+		if (match(bc_dirty[i].bd_blockno, arg))
+			blocks[n++] = bc_dirty[i].bd_blockno;
+		else
+			bc_dirty[j++] = bc_dirty[i];
+	bc_ndirty = j;
+	bc_write_blocks(blocks, n);
 }
 
 // Fault any disk block that is read in to memory by
@@ -49,14 +440,29 @@ bc_pgfault(struct UTrapframe *utf)
 	//
 	// LAB 5: you code here:
 	addr = ROUNDDOWN(addr, PGSIZE);
-	sys_page_alloc(thisenv->env_id, addr, PTE_SYSCALL);	// Why set all bits in PTE_AVAIL field, though?
-														// (How) Does the FS use these bits?
+
+	// The block may be on its way already
+	bc_io_wait();
+	if (va_is_mapped(addr)) {
+		// A write to a clean block
+		if ((utf->utf_err & FEC_WR) && !va_is_dirty(addr))
+			bc_dirtied(blockno);
+		return;
+	}
+
+	sys_ktrace(KTU_BC_PGFAULT, blockno);
+	bcstat.bs_misses++;
+	if (!bc_pinned(blockno))
+		bc_track(blockno);
+	// Leave the PTE_AVAIL bits clear; PTE_RA is one of them.
+	if ((r = sys_page_alloc(0, addr, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("in bc_pgfault, sys_page_alloc: %e", r);
 	ide_read(blockno * BLKSECTS, addr, BLKSECTS);
 
-	// Clear the dirty bit for the disk block page since we just read the
-	// block from disk
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
-		panic("in bc_pgfault, sys_page_map: %e", r);
+	// The block is clean since we just read it from disk, so make it
+	// read-only.  If this was a write, it faults again and
+	// bc_dirtied() takes over.
+	bc_clean(blockno);
 
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
@@ -66,7 +472,7 @@ bc_pgfault(struct UTrapframe *utf)
 }
 
 // Flush the contents of the block containing VA out to disk if
-// necessary, then clear the PTE_D bit using sys_page_map.
+// necessary, then make it read-only (clean) again.
 // If the block is not in the block cache or is not dirty, does
 // nothing.
 // Hint: Use va_is_mapped, va_is_dirty, and ide_write.
@@ -76,6 +482,7 @@ void
 flush_block(void *addr)
 {
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
+	int i;
 
 	if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
 		panic("flush_block of bad va %08x", addr);
@@ -84,10 +491,88 @@ flush_block(void *addr)
 	if ((va_is_mapped(addr) == 0) || (va_is_dirty(addr) == 0))
 		return;
 
-	addr = ROUNDDOWN(addr, PGSIZE);
-	ide_write(blockno * BLKSECTS, addr, BLKSECTS);
+	for (i = 0; i < bc_ndirty; i++)
+		if (bc_dirty[i].bd_blockno == blockno)
+			break;
+	if (i < bc_ndirty) {
+		memmove(&bc_dirty[i], &bc_dirty[i + 1], (bc_ndirty - i - 1) * sizeof(bc_dirty[0]));
+		bc_ndirty--;
+	}
+	bc_write_blocks(&blockno, 1);
+}
 
-	sys_page_map(thisenv->env_id, addr, thisenv->env_id, addr, PTE_SYSCALL);
+// Read the blocks in [blockno, blockno + n) that aren't in the cache
+// yet, ahead of use.  Each run of missing blocks comes in with a single
+// disk transfer, since consecutive blocks are consecutive in DISKMAP
+// too.  The blocks are marked PTE_RA until diskaddr() first returns
+// them.
+//
+// With DMA, only the first run is read, asynchronously, and nothing is
+// read if the disk is busy.  Returns how many blocks from 'blockno' on
+// are now in the cache or on their way.
+uint32_t
+bc_readahead(uint32_t blockno, uint32_t n)
+{
+	uint32_t start, end, i, first = blockno;
+	int r;
+
+	assert(n <= RA_MAXBLOCKS);
+	end = MIN(blockno + n, super->s_nblocks);
+
+	while (blockno < end && (bc_pinned(blockno) || va_is_mapped(BLOCKVA(blockno))))
+		blockno++;
+	if (blockno == end)
+		return end - first;
+	if (bcio_n > 0)
+		return blockno - first;
+	if ((r = bc_io_start(blockno, end - blockno, 1)) >= 0)
+		return blockno + r - first;
+
+	while (blockno < end) {
+		// Skip blocks we already have
+		while (blockno < end && (bc_pinned(blockno)
+					 || va_is_mapped(BLOCKVA(blockno))))
+			blockno++;
+
+		for (start = blockno; blockno < end; blockno++) {
+			if (bc_pinned(blockno) || va_is_mapped(BLOCKVA(blockno)))
+				break;
+			bc_track(blockno);
+			if ((r = sys_page_alloc(0, BLOCKVA(blockno), PTE_P|PTE_U|PTE_W|PTE_RA)) < 0)
+				panic("in bc_readahead, sys_page_alloc: %e", r);
+		}
+		if (start == blockno)
+			break;
+
+		sys_ktrace(KTU_BC_READAHEAD, start);
+		ide_read(start * BLKSECTS, BLOCKVA(start), (blockno - start) * BLKSECTS);
+		for (i = start; i < blockno; i++)
+			bc_clean(i);
+		bcstat.bs_ra_blocks += blockno - start;
+	}
+	return end - first;
+}
+
+// Write back every dirty block in the cache, in O(dirty blocks).
+void
+bc_sync(void)
+{
+	bc_writeback(bc_ndirty);
+}
+
+// Fill in the cache statistics.
+void
+bc_stat(struct BcStat *st)
+{
+	int i;
+
+	*st = bcstat;
+	st->bs_resident = 0;
+	for (i = 0; i < bc_nslots; i++)
+		if (va_is_mapped(BLOCKVA(bc_slots[i])))
+			st->bs_resident++;
+	st->bs_maxblocks = BC_MAXBLOCKS;
+	st->bs_dirty = bc_ndirty;
 }
 
 // Test that the block cache works, by smashing the superblock and
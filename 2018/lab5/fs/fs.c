@@ -11,6 +11,8 @@
 void
 check_super(void)
 {
+	if (super->s_magic == FS_MAGIC_BLKPTR)
+		panic("file system uses block pointers, not extents; rebuild it with fsformat");
 	if (super->s_magic != FS_MAGIC)
 		panic("bad file system magic number");
 
@@ -24,6 +26,26 @@ check_super(void)
 // Free block bitmap
 // --------------------------------------------------------------
 
+// The bitmap is summarized in groups of BM_GROUPBLOCKS blocks:
+// bm_group_free[g] counts the available blocks in group g, so the
+// search can skip over full groups without reading their bits.
+// Allocation without a better idea is next-fit: the search starts
+// where the previous one left off, bm_cursor, instead of at block 0,
+// so it doesn't have to walk past every block allocated so far.
+//
+// A block is available if it is free and not reserved.  Reserved
+// blocks (bm_reserved) are free blocks held in some file's
+// preallocation window; the reservation only exists in memory.
+#define BM_GROUPBLOCKS	1024
+#define BM_MAXGROUPS	(DISKSIZE / BLKSIZE / BM_GROUPBLOCKS)
+
+static uint16_t bm_group_free[BM_MAXGROUPS];
+static uint32_t bm_reserved[DISKSIZE / BLKSIZE / 32];
+static uint32_t bm_ngroups;
+static uint32_t bm_nfree;	// available blocks
+static uint32_t bm_nreserved;	// reserved blocks
+static uint32_t bm_cursor;
+
 // Check to see if the block bitmap indicates that block 'blockno' is free.
 // Return 1 if the block is free, 0 if not.
 bool
@@ -36,6 +58,14 @@ block_is_free(uint32_t blockno)
 	return 0;
 }
 
+// Is block 'blockno' free and not reserved?
+static bool
+block_is_avail(uint32_t blockno)
+{
+	return block_is_free(blockno)
+		&& !(bm_reserved[blockno / 32] & (1 << (blockno % 32)));
+}
+
 // Mark a block free in the bitmap
 void
 free_block(uint32_t blockno)
@@ -43,34 +73,219 @@ free_block(uint32_t blockno)
 	// Blockno zero is the null pointer of block numbers.
 	if (blockno == 0)
 		panic("attempt to free zero block");
+	if (block_is_free(blockno))
+		return;
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	bm_group_free[blockno / BM_GROUPBLOCKS]++;
+	bm_nfree++;
 }
 
-// Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
-//
-// Return block number allocated on success,
-// -E_NO_DISK if we are out of blocks.
-//
-// Hint: use free_block as an example for manipulating the bitmap.
-int
-alloc_block(void)
+// Hold an available block for a preallocation window, or give it back.
+static void
+bm_reserve(uint32_t blockno)
+{
+	bm_reserved[blockno / 32] |= 1 << (blockno % 32);
+	bm_group_free[blockno / BM_GROUPBLOCKS]--;
+	bm_nfree--;
+	bm_nreserved++;
+}
+
+static void
+bm_unreserve(uint32_t blockno)
+{
+	bm_reserved[blockno / 32] &= ~(1 << (blockno % 32));
+	bm_group_free[blockno / BM_GROUPBLOCKS]++;
+	bm_nfree++;
+	bm_nreserved--;
+}
+
+// Mark a free block, reserved or not, in use.  The changed bitmap
+// block is left dirty in the block cache instead of being written
+// right away.  Every write-back, whatever it was for, writes all dirty
+// bitmap blocks first (see bc_write_blocks), so nothing pointing at
+// the new block reaches the disk before the bitmap saying it's in use.
+static void
+bm_take(uint32_t blockno)
+{
+	if (bm_reserved[blockno / 32] & (1 << (blockno % 32))) {
+		bm_reserved[blockno / 32] &= ~(1 << (blockno % 32));
+		bm_nreserved--;
+	} else {
+		bm_group_free[blockno / BM_GROUPBLOCKS]--;
+		bm_nfree--;
+	}
+	bitmap[blockno / 32] &= ~(1 << (blockno % 32));
+}
+
+// Find an available block, looking at 'start' and the blocks after it
+// first and going once around the disk from there.
+// Returns its block number, or -E_NO_DISK if there is none.
+static int
+bm_search(uint32_t start)
 {
 	// The bitmap consists of one or more blocks.  A single bitmap block
 	// contains the in-use bits for BLKBITSIZE blocks.  There are
 	// super->s_nblocks blocks in the disk altogether.
+	uint32_t g, i, w, end, bits, blockno;
+
+	if (bm_nfree == 0)
+		return -E_NO_DISK;
+	if (start >= super->s_nblocks)
+		start = 0;
+
+	// Go once around the groups starting at start's, then look at
+	// the part of that group before start.
+	g = start / BM_GROUPBLOCKS;
+	for (i = 0; i <= bm_ngroups; i++, g = (g + 1) % bm_ngroups) {
+		if (bm_group_free[g] == 0)
+			continue;
+		w = (i == 0 ? start : g * BM_GROUPBLOCKS) / 32;
+		end = MIN((g + 1) * BM_GROUPBLOCKS, super->s_nblocks);
+		for (; w * 32 < end; w++) {
+			// A word at a time; zero means 32 blocks unavailable
+			if ((bits = bitmap[w] & ~bm_reserved[w]) == 0)
+				continue;
+			// Don't go back before start on the first time around
+			if (i == 0 && w == start / 32)
+				bits &= ~((1 << (start % 32)) - 1);
+			if (bits == 0)
+				continue;
+			blockno = w * 32 + __builtin_ctz(bits);
+			if (blockno >= end)
+				break;
+			return blockno;
+		}
+	}
+
+	panic("bm_search: %u blocks free but none in the bitmap", bm_nfree);
+}
+
+// Number of free blocks on the disk, counting reserved ones.
+uint32_t
+free_block_count(void)
+{
+	return bm_nfree + bm_nreserved;
+}
+
+// Build the free block summary from the bitmap.  Bits past
+// super->s_nblocks in the last bitmap word don't stand for blocks
+// and aren't counted.
+static void
+bm_init(void)
+{
+	uint32_t w, bits, nbits;
+
+	bm_ngroups = ROUNDUP(super->s_nblocks, BM_GROUPBLOCKS) / BM_GROUPBLOCKS;
+	for (w = 0; w * 32 < super->s_nblocks; w++) {
+		bits = bitmap[w];
+		nbits = super->s_nblocks - w * 32;
+		if (nbits < 32)
+			bits &= (1 << nbits) - 1;
+		bm_group_free[w * 32 / BM_GROUPBLOCKS] += __builtin_popcount(bits);
+		bm_nfree += __builtin_popcount(bits);
+	}
+	bm_cursor = 0;
+}
+
+// Preallocation windows.  When a file gets a new block, the available
+// blocks right after it are reserved for the file's next allocations,
+// up to PREALLOC_BLOCKS of them.  So a file growing a block at a time
+// gets contiguous blocks even while other files are growing next to
+// it.  A window lasts until its blocks are used up, the file is
+// flushed or truncated, or its slot is taken by another file.
+static struct Prealloc {
+	struct File *pa_file;	// file holding the window, 0 if none
+	uint32_t pa_next;	// next block to hand out
+	uint32_t pa_end;	// block after the window
+} prealloc[NPREALLOC];
+static int prealloc_hand;
+
+// Give the unused blocks in a window back.
+static void
+prealloc_release(struct Prealloc *pa)
+{
+	for (; pa->pa_next < pa->pa_end; pa->pa_next++)
+		bm_unreserve(pa->pa_next);
+	pa->pa_file = 0;
+}
+
+static struct Prealloc *
+prealloc_find(struct File *f)
+{
+	int i;
+
+	for (i = 0; i < NPREALLOC; i++)
+		if (prealloc[i].pa_file == f)
+			return &prealloc[i];
+	return 0;
+}
+
+// Drop f's preallocation window, if it has one.
+static void
+file_prealloc_drop(struct File *f)
+{
+	struct Prealloc *pa;
+
+	if ((pa = prealloc_find(f)) != 0)
+		prealloc_release(pa);
+}
+
+// The directory block holding f.  The root is in the superblock.
+static uint32_t
+file_dirblock(struct File *f)
+{
+	return ((uintptr_t) f - DISKMAP) / BLKSIZE;
+}
+
+// bm_search, but when no block is available and some free blocks are
+// held in preallocation windows, give up all the windows and try again.
+static int
+bm_search_all(uint32_t start)
+{
+	int i, r;
+
+	if ((r = bm_search(start)) == -E_NO_DISK && bm_nreserved > 0) {
+		for (i = 0; i < NPREALLOC; i++)
+			prealloc_release(&prealloc[i]);
+		r = bm_search(start);
+	}
+	return r;
+}
+
+// Allocate a block for file f, preferably 'goal'.  Blocks come out
+// of f's preallocation window while it lasts.  Otherwise this takes
+// the first available block at or after 'goal' and opens a new window
+// right behind it.
+// Returns the block number or -E_NO_DISK.
+static int
+file_alloc_block(struct File *f, uint32_t goal)
+{
+	struct Prealloc *pa;
+	uint32_t b;
+	int r;
 
-	// LAB 5: Your code here.
-	for (int i = 0; i < super->s_nblocks; i++) {
-		if (block_is_free(i)) {
-			bitmap[i / 32] &= ~(1 << (i % 32));
-			flush_block((void *)bitmap + PGSIZE * (i / BLKBITSIZE));
-			return i;
+	if ((pa = prealloc_find(f)) != 0) {
+		if (pa->pa_next < pa->pa_end) {
+			b = pa->pa_next++;
+			bm_take(b);
+			return b;
 		}
+		prealloc_release(pa);
 	}
 
-	return -E_NO_DISK;
+	if ((r = bm_search_all(goal)) < 0)
+		return r;
+	bm_take(r);
+
+	pa = &prealloc[prealloc_hand];
+	prealloc_hand = (prealloc_hand + 1) % NPREALLOC;
+	prealloc_release(pa);
+	pa->pa_file = f;
+	pa->pa_next = pa->pa_end = r + 1;
+	while (pa->pa_end - pa->pa_next < PREALLOC_BLOCKS
+	       && block_is_avail(pa->pa_end))
+		bm_reserve(pa->pa_end++);
+	return r;
 }
 
 // Validate the file system bitmap.
@@ -110,6 +325,7 @@ fs_init(void)
 		ide_set_disk(1);
 	else
 		ide_set_disk(0);
+	ide_dma_init();
 	bc_init();
 
 	// Set "super" to point to the super block.
@@ -119,78 +335,399 @@ fs_init(void)
 	// Set "bitmap" to the beginning of the first bitmap block.
 	bitmap = diskaddr(2);
 	check_bitmap();
-	
+	bm_init();
 }
 
-// Find the disk block number slot for the 'filebno'th block in file 'f'.
-// Set '*ppdiskbno' to point to that slot.
-// The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
-// if necessary.
-//
-// Returns:
-//	0 on success (but note that *ppdiskbno might equal 0).
-//	-E_NOT_FOUND if the function needed to allocate an indirect block, but
-//		alloc was 0.
-//	-E_NO_DISK if there's no space on the disk for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NDIRECT + NINDIRECT).
-//
-// Analogy: This is like pgdir_walk for files.
-// Hint: Don't forget to clear any block you allocate.
+// --------------------------------------------------------------
+// Extents
+// --------------------------------------------------------------
+
+// The extent cache remembers the extent each of the last few files
+// looked up, so a reader going through a file in order finds its next
+// block without a search and without touching the extent block.  A
+// file's entry is forgotten whenever its block map changes.
+#define NEXTCACHE	64
+#define EXTCACHE_SLOT(f) \
+	(&extcache[((uintptr_t) (f) / sizeof(struct File)) % NEXTCACHE])
+
+static struct ExtCache {
+	struct File *ec_file;		// 0 if empty
+	struct Extent ec_extent;
+} extcache[NEXTCACHE];
+
+static void
+extcache_forget(struct File *f)
+{
+	struct ExtCache *ec = EXTCACHE_SLOT(f);
+
+	if (ec->ec_file == f)
+		ec->ec_file = 0;
+}
+
+// Extent number i of file f, in f itself or in its extent block.
+static struct Extent *
+file_extent(struct File *f, uint32_t i)
+{
+	if (i < NINLINE)
+		return &f->f_extents[i];
+	return (struct Extent *) diskaddr(f->f_extblock) + (i - NINLINE);
+}
+
+// Return the index of the last extent of f that starts at or before
+// file block 'filebno', or -1 if there is none.
 static int
-file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc)
+file_extent_find(struct File *f, uint32_t filebno)
 {
-       // LAB 5: Your code here.
-		int r;
+	int lo = 0, hi = f->f_nextents, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (file_extent(f, mid)->e_fileblock <= filebno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
 
-    	if (filebno >= NDIRECT + NINDIRECT)
-			return -E_INVAL;
+static void
+file_extent_remove(struct File *f, uint32_t i)
+{
+	for (; i + 1 < f->f_nextents; i++)
+		*file_extent(f, i) = *file_extent(f, i + 1);
+	f->f_nextents--;
+}
 
-		if (filebno < NDIRECT) {
-			*ppdiskbno = &f->f_direct[filebno];
-			return 0;
+// Find file block 'filebno' of f.  Set *pdiskbno to the disk block
+// holding it and *prun to the number of blocks from there to the end
+// of its extent, which are consecutive on disk; or set both to 0 if
+// the block isn't allocated.
+//
+// Analogy: This is like pgdir_walk for files.
+static void
+file_map_block(struct File *f, uint32_t filebno, uint32_t *pdiskbno, uint32_t *prun)
+{
+	struct ExtCache *ec = EXTCACHE_SLOT(f);
+	struct Extent *e = &ec->ec_extent;
+	int i;
+
+	if (ec->ec_file != f || filebno < e->e_fileblock
+	    || filebno >= e->e_fileblock + e->e_len) {
+		if ((i = file_extent_find(f, filebno)) < 0
+		    || filebno >= file_extent(f, i)->e_fileblock + file_extent(f, i)->e_len) {
+			*pdiskbno = *prun = 0;
+			return;
 		}
+		ec->ec_file = f;
+		*e = *file_extent(f, i);
+	}
+	*pdiskbno = e->e_diskblock + (filebno - e->e_fileblock);
+	*prun = e->e_fileblock + e->e_len - filebno;
+}
+
+// Record that file block 'filebno' of f, which wasn't allocated, is
+// now in disk block 'diskbno'.  The block joins the extent before or
+// after it when it is consecutive with it on disk, and otherwise
+// starts a new extent.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_DISK if f has no room for another extent, or there's no
+//		space on the disk for its extent block.
+static int
+file_extent_add(struct File *f, uint32_t filebno, uint32_t diskbno)
+{
+	struct Extent *e, *next = 0;
+	int i, j, r;
+
+	extcache_forget(f);
+	i = file_extent_find(f, filebno);
+	if (i + 1 < f->f_nextents) {
+		next = file_extent(f, i + 1);
+		if (next->e_fileblock != filebno + 1 || next->e_diskblock != diskbno + 1)
+			next = 0;
+	}
 
-		filebno -= NDIRECT;
-		if (f->f_indirect == 0) {
-			if (alloc == 0)
-				return -E_NOT_FOUND;
-			if ((r = alloc_block()) < 0)	// -E_NO_DISK
-				return r;
-			memset(diskaddr(r), 0, BLKSIZE);
-			f->f_indirect = r;
+	if (i >= 0) {
+		e = file_extent(f, i);
+		if (e->e_fileblock + e->e_len == filebno
+		    && e->e_diskblock + e->e_len == diskbno) {
+			e->e_len++;
+			// The gap between two extents is filled in
+			if (next) {
+				e->e_len += next->e_len;
+				file_extent_remove(f, i + 1);
+			}
+			return 0;
 		}
-		uint32_t *f_indirect = diskaddr(f->f_indirect);
-		*ppdiskbno = &f_indirect[filebno];
+	}
+	if (next) {
+		next->e_fileblock--;
+		next->e_diskblock--;
+		next->e_len++;
 		return 0;
+	}
+
+	if (f->f_nextents == NEXTENT)
+		return -E_NO_DISK;
+	if (f->f_nextents == NINLINE && f->f_extblock == 0) {
+		// Not out of f's preallocation window, which f's data
+		// blocks are using
+		if ((r = bm_search_all(bm_cursor)) < 0)
+			return r;
+		bm_take(r);
+		bm_cursor = r + 1;
+		memset(diskaddr(r), 0, BLKSIZE);
+		f->f_extblock = r;
+	}
+	for (j = f->f_nextents; j > i + 1; j--)
+		*file_extent(f, j) = *file_extent(f, j - 1);
+	e = file_extent(f, i + 1);
+	e->e_fileblock = filebno;
+	e->e_diskblock = diskbno;
+	e->e_len = 1;
+	f->f_nextents++;
+	return 0;
+}
+
+// Where file block 'filebno' of f should go on disk: right after
+// file block filebno-1, or for the first block, right after the
+// directory block holding f.
+static uint32_t
+file_alloc_goal(struct File *f, uint32_t filebno)
+{
+	uint32_t diskbno = 0, run;
+
+	if (filebno > 0)
+		file_map_block(f, filebno - 1, &diskbno, &run);
+	if (diskbno != 0)
+		return diskbno + 1;
+	return file_dirblock(f) + 1;
 }
 
 // Set *blk to the address in memory where the filebno'th
-// block of file 'f' would be mapped.
+// block of file 'f' would be mapped, allocating the block if
+// it isn't yet.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
-//	-E_NO_DISK if a block needed to be allocated but the disk is full.
+//	-E_NO_DISK if a block needed to be allocated but the disk is full,
+//		or f has too many extents already.
 //	-E_INVAL if filebno is out of range.
-//
-// Hint: Use file_block_walk and alloc_block.
 int
 file_get_block(struct File *f, uint32_t filebno, char **blk)
 {
-       // LAB 5: Your code here.
-		uint32_t *pdiskbno;
-		int r;
+	uint32_t diskbno, run;
+	int r;
+
+	if (filebno >= MAXFILESIZE / BLKSIZE)
+		return -E_INVAL;
 
-		if ((r = file_block_walk(f, filebno, &pdiskbno, 1)) < 0)
+	file_map_block(f, filebno, &diskbno, &run);
+	if (diskbno == 0) {	// Block is not allocated yet.
+		if ((r = file_alloc_block(f, file_alloc_goal(f, filebno))) < 0)
+			return r;
+		diskbno = r;
+		if ((r = file_extent_add(f, filebno, diskbno)) < 0) {
+			free_block(diskbno);
 			return r;
-		if (*pdiskbno == 0) {	// Block is not allocate yet.
-			if ((r = alloc_block()) < 0)	// -E_NO_DISK
-				return r;
-			memset(diskaddr(r), 0, BLKSIZE);
-			*pdiskbno = r;
 		}
-		*blk = diskaddr(*pdiskbno);
+		memset(diskaddr(diskbno), 0, BLKSIZE);
+	}
+	*blk = diskaddr(diskbno);
+	return 0;
+}
+
+// Read blocks [filebno, filebno + n) of file 'f' into the block cache
+// ahead of use.  Each extent, up to RA_MAXBLOCKS of it at a time,
+// goes to bc_readahead() as one run, so it costs one disk transfer.
+// Stops at the end of the file, at the first hole, or where
+// bc_readahead() has to stop because the disk is busy.
+// Returns the file block number it got up to.
+uint32_t
+file_readahead(struct File *f, uint32_t filebno, uint32_t n)
+{
+	uint32_t diskbno, run, end, len, done;
+
+	end = MIN(filebno + n, ROUNDUP((uint32_t) f->f_size, BLKSIZE) / BLKSIZE);
+	while (filebno < end) {
+		file_map_block(f, filebno, &diskbno, &run);
+		if (diskbno == 0)
+			break;
+		len = MIN(MIN(run, end - filebno), RA_MAXBLOCKS);
+		if ((done = bc_readahead(diskbno, len)) < len)
+			return filebno + done;
+		filebno += len;
+	}
+	return filebno;
+}
+
+// Return the disk block number of the first block of bytes
+// [offset, offset + count) of file 'f' that isn't in the block cache,
+// or 0 if they all are (holes and bytes past the end don't count).
+uint32_t
+file_read_miss(struct File *f, off_t offset, size_t count)
+{
+	uint32_t diskbno, run, filebno, last, i;
+
+	if (offset >= f->f_size || count == 0)
+		return 0;
+	count = MIN(count, f->f_size - offset);
+
+	last = (offset + count - 1) / BLKSIZE;
+	for (filebno = offset / BLKSIZE; filebno <= last; filebno += MAX(run, 1)) {
+		file_map_block(f, filebno, &diskbno, &run);
+		run = MIN(run, last - filebno + 1);
+		for (i = 0; i < run; i++)
+			if (!bc_resident(diskbno + i))
+				return diskbno + i;
+	}
+	return 0;
+}
+
+// --------------------------------------------------------------
+// Directory index
+// --------------------------------------------------------------
+
+// Directories of DH_MINBLOCKS blocks or more get an in-memory hash
+// index the first time they are searched, so that looking a name up
+// doesn't read and compare every entry.  The index is kept up to date
+// as files are created, and dropped if the directory is truncated.
+// Entries point straight at the struct File in the block cache, so a
+// hit only touches the one block the file is in.
+//
+// All indexes share one pool of DH_MAXENTS entries and DH_NBUCKETS
+// hash chains.  When the pool or the table of indexed directories is
+// full, every index is dropped and rebuilt on demand.
+#define DH_MINBLOCKS	4
+#define DH_MAXDIRS	16
+#define DH_NBUCKETS	8192
+#define DH_MAXENTS	32768
+
+static struct DirIndex {
+	struct File *di_dir;		// indexed directory, 0 if none
+	uint32_t di_free;		// first block that may have a free entry
+} dh_dirs[DH_MAXDIRS];
+
+static struct DirHashEnt {
+	struct File *de_file;
+	uint32_t de_hash;
+	uint32_t de_next;		// next entry in the chain plus 1, 0 at the end
+	struct DirIndex *de_di;		// directory the entry is in
+} dh_ents[DH_MAXENTS];
+
+static uint32_t dh_buckets[DH_NBUCKETS];	// first entry of each chain plus 1, 0 if none
+static uint32_t dh_nents;
+
+// FNV-1a
+static uint32_t
+dh_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *name; name++)
+		h = (h ^ (uint8_t) *name) * 16777619U;
+	return h;
+}
+
+static uint32_t
+dh_bucket(struct DirIndex *di, uint32_t hash)
+{
+	return (hash ^ ((uintptr_t) di->di_dir / sizeof(struct File))) % DH_NBUCKETS;
+}
+
+// Drop every index.
+static void
+dh_reset(void)
+{
+	memset(dh_dirs, 0, sizeof(dh_dirs));
+	memset(dh_buckets, 0, sizeof(dh_buckets));
+	dh_nents = 0;
+}
+
+// Add file f, which is in the directory di indexes, to the index.
+// Returns 0, or -E_NO_MEM if the pool is full.
+static int
+dh_add(struct DirIndex *di, struct File *f)
+{
+	struct DirHashEnt *de;
+	uint32_t b;
+
+	if (dh_nents == DH_MAXENTS)
+		return -E_NO_MEM;
+	de = &dh_ents[dh_nents];
+	de->de_file = f;
+	de->de_hash = dh_hash(f->f_name);
+	de->de_di = di;
+	b = dh_bucket(di, de->de_hash);
+	de->de_next = dh_buckets[b];
+	dh_buckets[b] = ++dh_nents;
+	return 0;
+}
+
+static struct DirIndex *
+dir_index_find(struct File *dir)
+{
+	int i;
+
+	for (i = 0; i < DH_MAXDIRS; i++)
+		if (dh_dirs[i].di_dir == dir)
+			return &dh_dirs[i];
+	return 0;
+}
+
+// Return dir's index, building it if dir is big enough to need one
+// and doesn't have one yet.  Returns 0 if dir isn't indexed.
+static struct DirIndex *
+dir_index(struct File *dir)
+{
+	struct DirIndex *di;
+	struct File *f;
+	uint32_t i, j, nblock;
+	char *blk;
+
+	if ((di = dir_index_find(dir)) != 0)
+		return di;
+	nblock = dir->f_size / BLKSIZE;
+	if (nblock < DH_MINBLOCKS || nblock * BLKFILES > DH_MAXENTS)
 		return 0;
+
+	if (dh_nents + nblock * BLKFILES > DH_MAXENTS
+	    || (di = dir_index_find(0)) == 0) {
+		dh_reset();
+		di = &dh_dirs[0];
+	}
+	di->di_dir = dir;
+	di->di_free = nblock;
+	for (i = 0; i < nblock; i++) {
+		if (file_get_block(dir, i, &blk) < 0)
+			panic("dir_index: can't read block %d of %s", i, dir->f_name);
+		f = (struct File*) blk;
+		for (j = 0; j < BLKFILES; j++) {
+			if (f[j].f_name[0] == '\0')
+				di->di_free = MIN(di->di_free, i);
+			else
+				dh_add(di, &f[j]);
+		}
+	}
+	return di;
+}
+
+// Drop dir's index, if it has one.  Entries can't be taken out of the
+// chains one directory at a time, so this drops every index.
+static void
+dir_index_drop(struct File *dir)
+{
+	if (dir_index_find(dir) != 0)
+		dh_reset();
+}
+
+// Add the new file f in dir to dir's index, if it has one.
+static void
+dir_index_add(struct File *dir, struct File *f)
+{
+	struct DirIndex *di;
+
+	if ((di = dir_index_find(dir)) != 0 && dh_add(di, f) < 0)
+		dir_index_drop(dir);	// rebuilt on the next lookup
 }
 
 // Try to find a file named "name" in dir.  If so, set *file to it.
@@ -201,14 +738,30 @@ static int
 dir_lookup(struct File *dir, const char *name, struct File **file)
 {
 	int r;
-	uint32_t i, j, nblock;
+	uint32_t i, j, nblock, hash, e;
+	struct DirHashEnt *de;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
 
-	// Search dir for name.
 	// We maintain the invariant that the size of a directory-file
 	// is always a multiple of the file system's block size.
 	assert((dir->f_size % BLKSIZE) == 0);
+
+	if ((di = dir_index(dir)) != 0) {
+		hash = dh_hash(name);
+		for (e = dh_buckets[dh_bucket(di, hash)]; e != 0; e = de->de_next) {
+			de = &dh_ents[e - 1];
+			if (de->de_di == di && de->de_hash == hash
+			    && strcmp(de->de_file->f_name, name) == 0) {
+				*file = de->de_file;
+				return 0;
+			}
+		}
+		return -E_NOT_FOUND;
+	}
+
+	// Search dir for name.
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -224,7 +777,8 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 }
 
 // Set *file to point at a free File structure in dir.  The caller is
-// responsible for filling in the File fields.
+// responsible for filling in the File fields, and for adding it to
+// dir's index once it has a name.
 static int
 dir_alloc_file(struct File *dir, struct File **file)
 {
@@ -232,15 +786,21 @@ dir_alloc_file(struct File *dir, struct File **file)
 	uint32_t nblock, i, j;
 	char *blk;
 	struct File *f;
+	struct DirIndex *di;
 
 	assert((dir->f_size % BLKSIZE) == 0);
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
+	// Entries are never freed, so an indexed directory's blocks
+	// before di_free are full.
+	di = dir_index_find(dir);
+	for (i = di ? di->di_free : 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
 			return r;
 		f = (struct File*) blk;
 		for (j = 0; j < BLKFILES; j++)
 			if (f[j].f_name[0] == '\0') {
+				if (di)
+					di->di_free = i;
 				*file = &f[j];
 				return 0;
 			}
@@ -248,11 +808,80 @@ dir_alloc_file(struct File *dir, struct File **file)
 	dir->f_size += BLKSIZE;
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
+	if (di)
+		di->di_free = i;
 	f = (struct File*) blk;
 	*file = &f[0];
 	return 0;
 }
 
+// --------------------------------------------------------------
+// Path lookup cache
+// --------------------------------------------------------------
+
+// The dentry cache remembers the result of recent directory lookups,
+// (directory, name) -> File, so that walk_path doesn't search the same
+// directories over and over for the same paths.  Names that weren't
+// found are cached too (dc_file == 0), since sh and spawn try paths
+// that don't exist all the time.  The cache is direct-mapped.
+//
+// An entry has to go whenever its answer may change: when a file is
+// created in the directory, and when the directory is truncated (which
+// throws out everything, as it's rare).  Removing a file will have to
+// call dcache_forget too.
+#define NDCACHE		512
+
+static struct Dentry {
+	struct File *dc_dir;		// directory looked in, 0 if unused
+	struct File *dc_file;		// what was found, 0 if nothing
+	char dc_name[MAXNAMELEN];
+} dcache[NDCACHE];
+
+static struct Dentry *
+dcache_slot(struct File *dir, const char *name)
+{
+	return &dcache[(dh_hash(name) ^ ((uintptr_t) dir / sizeof(struct File))) % NDCACHE];
+}
+
+// Forget what we know about 'name' in 'dir'.
+static void
+dcache_forget(struct File *dir, const char *name)
+{
+	struct Dentry *dc = dcache_slot(dir, name);
+
+	if (dc->dc_dir == dir && strcmp(dc->dc_name, name) == 0)
+		dc->dc_dir = 0;
+}
+
+static void
+dcache_reset(void)
+{
+	memset(dcache, 0, sizeof(dcache));
+}
+
+// dir_lookup through the dentry cache.
+static int
+dir_lookup_cached(struct File *dir, const char *name, struct File **file)
+{
+	struct Dentry *dc = dcache_slot(dir, name);
+	int r;
+
+	if (dc->dc_dir == dir && strcmp(dc->dc_name, name) == 0) {
+		if (!dc->dc_file)
+			return -E_NOT_FOUND;
+		*file = dc->dc_file;
+		return 0;
+	}
+
+	r = dir_lookup(dir, name, file);
+	if (r < 0 && r != -E_NOT_FOUND)
+		return r;
+	dc->dc_dir = dir;
+	dc->dc_file = r < 0 ? 0 : *file;
+	strcpy(dc->dc_name, name);
+	return r;
+}
+
 // Skip over slashes.
 static const char*
 skip_slash(const char *p)
@@ -300,7 +929,7 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 		if (dir->f_type != FTYPE_DIR)
 			return -E_NOT_FOUND;
 
-		if ((r = dir_lookup(dir, name, &f)) < 0) {
+		if ((r = dir_lookup_cached(dir, name, &f)) < 0) {
 			if (r == -E_NOT_FOUND && *path == '\0') {
 				if (pdir)
 					*pdir = dir;
@@ -339,6 +968,8 @@ file_create(const char *path, struct File **pf)
 		return r;
 
 	strcpy(f->f_name, name);
+	dir_index_add(dir, f);
+	dcache_forget(dir, name);
 	*pf = f;
 	file_flush(dir);
 	return 0;
@@ -408,47 +1039,35 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 	return count;
 }
 
-// Remove a block from file f.  If it's not there, just silently succeed.
-// Returns 0 on success, < 0 on error.
-static int
-file_free_block(struct File *f, uint32_t filebno)
-{
-	int r;
-	uint32_t *ptr;
-
-	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
-		return r;
-	if (*ptr) {
-		free_block(*ptr);
-		*ptr = 0;
-	}
-	return 0;
-}
-
-// Remove any blocks currently used by file 'f',
-// but not necessary for a file of size 'newsize'.
-// For both the old and new sizes, figure out the number of blocks required,
-// and then clear the blocks from new_nblocks to old_nblocks.
-// If the new_nblocks is no more than NDIRECT, and the indirect block has
-// been allocated (f->f_indirect != 0), then free the indirect block too.
-// (Remember to clear the f->f_indirect pointer so you'll know
-// whether it's valid!)
+// Free the blocks of file 'f' that a file of size 'newsize' doesn't
+// need.  Extents are sorted, so those are in the last few extents,
+// the first of which may only need to be cut short.  Once f fits in
+// NINLINE extents again, its extent block is freed too.
 // Do not change f->f_size.
 static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
-	int r;
-	uint32_t bno, old_nblocks, new_nblocks;
+	uint32_t new_nblocks, keep, b;
+	struct Extent *e;
 
-	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+	extcache_forget(f);
 	new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
-	for (bno = new_nblocks; bno < old_nblocks; bno++)
-		if ((r = file_free_block(f, bno)) < 0)
-			cprintf("warning: file_free_block: %e", r);
+	while (f->f_nextents > 0) {
+		e = file_extent(f, f->f_nextents - 1);
+		if (e->e_fileblock + e->e_len <= new_nblocks)
+			break;
+		keep = new_nblocks > e->e_fileblock ? new_nblocks - e->e_fileblock : 0;
+		for (b = keep; b < e->e_len; b++)
+			free_block(e->e_diskblock + b);
+		e->e_len = keep;
+		if (keep > 0)
+			break;
+		f->f_nextents--;
+	}
 
-	if (new_nblocks <= NDIRECT && f->f_indirect) {
-		free_block(f->f_indirect);
-		f->f_indirect = 0;
+	if (f->f_nextents <= NINLINE && f->f_extblock) {
+		free_block(f->f_extblock);
+		f->f_extblock = 0;
 	}
 }
 
@@ -456,41 +1075,76 @@ file_truncate_blocks(struct File *f, off_t newsize)
 int
 file_set_size(struct File *f, off_t newsize)
 {
-	if (f->f_size > newsize)
+	if (f->f_size > newsize) {
+		file_prealloc_drop(f);
+		if (f->f_type == FTYPE_DIR) {
+			dir_index_drop(f);
+			dcache_reset();
+		}
 		file_truncate_blocks(f, newsize);
+	}
 	f->f_size = newsize;
 	flush_block(f);
 	return 0;
 }
 
+// Is blockno one of file f's blocks: its data, its extent block, or
+// the directory block holding f itself?
+static bool
+file_has_block(uint32_t blockno, void *arg)
+{
+	struct File *f = arg;
+	struct Extent *e;
+	uint32_t i;
+
+	if (blockno == file_dirblock(f) || blockno == f->f_extblock)
+		return 1;
+	for (i = 0; i < f->f_nextents; i++) {
+		e = file_extent(f, i);
+		if (blockno >= e->e_diskblock
+		    && blockno < e->e_diskblock + e->e_len)
+			return 1;
+	}
+	return 0;
+}
+
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Only blocks that are dirty can need writing, so walk the cache's
+// dirty list and write out the ones that belong to f, rather than
+// every block f has.  They go as one batch, which takes the dirty
+// bitmap blocks with it.
 void
 file_flush(struct File *f)
 {
-	int i;
-	uint32_t *pdiskbno;
+	// f is done growing for now
+	file_prealloc_drop(f);
+	bc_flush_if(file_has_block, f);
+}
 
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
-			continue;
-		flush_block(diskaddr(*pdiskbno));
+// Count the blocks of file f and the extents, runs of blocks that are
+// consecutive both in f and on disk, that they make up.
+void
+file_extents(struct File *f, uint32_t *pnblocks, uint32_t *pnextents)
+{
+	struct Extent *e, prev = { 0, 0, 0 };
+	uint32_t i;
+
+	*pnblocks = *pnextents = 0;
+	for (i = 0; i < f->f_nextents; i++) {
+		e = file_extent(f, i);
+		if (prev.e_len == 0 || e->e_fileblock != prev.e_fileblock + prev.e_len
+		    || e->e_diskblock != prev.e_diskblock + prev.e_len)
+			(*pnextents)++;
+		*pnblocks += e->e_len;
+		prev = *e;
 	}
-	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
 }
 
-
-// Sync the entire file system.  A big hammer.
+// Sync the entire file system.  A big hammer, but it only costs as
+// much as there are dirty blocks.
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	bc_sync();
 }
 
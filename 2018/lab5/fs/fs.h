@@ -0,0 +1,102 @@
+#include <inc/fs.h>
+#include <inc/lib.h>
+
+#define SECTSIZE	512			// bytes per disk sector
+#define BLKSECTS	(BLKSIZE / SECTSIZE)	// sectors per block
+
+/* Disk block n, when in memory, is mapped into the file system
+ * server's address space at DISKMAP + (n*BLKSIZE). */
+#define DISKMAP		0x10000000
+
+/* Maximum disk size we can handle (3GB) */
+#define DISKSIZE	0xC0000000
+
+/* Maximum number of evictable blocks the block cache keeps mapped at
+ * once.  The superblock and the bitmap blocks are pinned and don't
+ * count against this.  An instruction can touch a handful of blocks,
+ * so this must stay well above that or the clock can livelock. */
+#ifndef BC_MAXBLOCKS
+#define BC_MAXBLOCKS	1024
+#endif
+
+/* Dirty blocks.  At most BC_MAXDIRTY blocks are dirty at once.  The
+ * background flusher writes back blocks that have been dirty for
+ * BC_DIRTY_AGE milliseconds, and older ones early if more than
+ * BC_DIRTY_HIGH are dirty, until BC_DIRTY_LOW are. */
+#define BC_MAXDIRTY	256
+#define BC_DIRTY_HIGH	(BC_MAXDIRTY / 2)
+#define BC_DIRTY_LOW	(BC_MAXDIRTY / 4)
+#define BC_DIRTY_AGE	1000
+
+/* Sequential read-ahead window, in blocks.  The largest window has to
+ * fit in a single IDE transfer (256 sectors) and stay small next to
+ * BC_MAXBLOCKS, so the clock never evicts part of a batch while it is
+ * still being read in. */
+#define RA_MINBLOCKS	4
+#define RA_MAXBLOCKS	32
+
+/* Preallocation: a file that allocates a block gets up to
+ * PREALLOC_BLOCKS blocks after it held for its next allocations.  At
+ * most NPREALLOC files hold such a window at once. */
+#define PREALLOC_BLOCKS	16
+#define NPREALLOC	32
+
+/* Software PTE bit on a block that was read ahead and hasn't been
+ * looked up yet. */
+#define PTE_RA		0x200
+
+struct Super *super;		// superblock
+uint32_t *bitmap;		// bitmap blocks mapped in memory
+
+/* ide.c */
+bool	ide_probe_disk1(void);
+void	ide_set_disk(int diskno);
+void	ide_set_partition(uint32_t first_sect, uint32_t nsect);
+void	ide_dma_init(void);
+int	ide_read(uint32_t secno, void *dst, size_t nsecs);
+int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+int	ide_read_pio(uint32_t secno, void *dst, size_t nsecs);
+int	ide_write_pio(uint32_t secno, const void *src, size_t nsecs);
+int	ide_dma(uint32_t secno, void *va, size_t nsecs, bool write);
+int	ide_dma_start(uint32_t secno, void *va, size_t nsecs, bool write);
+bool	ide_dma_busy(void);
+bool	ide_dma_done(int *result);
+void	ide_bench(void);
+
+/* bc.c */
+void*	diskaddr(uint32_t blockno);
+bool	va_is_mapped(void *va);
+bool	va_is_dirty(void *va);
+void	flush_block(void *addr);
+void	bc_init(void);
+void	bc_sync(void);
+uint32_t bc_readahead(uint32_t blockno, uint32_t n);
+bool	bc_resident(uint32_t blockno);
+int	bc_fetch(uint32_t blockno);
+bool	bc_io_poll(void);
+void	bc_stat(struct BcStat *st);
+uint32_t bc_writeback_aged(void);
+void	bc_flush_if(bool (*match)(uint32_t blockno, void *arg), void *arg);
+
+/* fs.c */
+void	fs_init(void);
+int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+uint32_t file_readahead(struct File *f, uint32_t file_blockno, uint32_t n);
+uint32_t file_read_miss(struct File *f, off_t offset, size_t count);
+int	file_create(const char *path, struct File **f);
+int	file_open(const char *path, struct File **f);
+ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset);
+int	file_write(struct File *f, const void *buf, size_t count, off_t offset);
+int	file_set_size(struct File *f, off_t newsize);
+void	file_flush(struct File *f);
+void	file_extents(struct File *f, uint32_t *pnblocks, uint32_t *pnextents);
+int	file_remove(const char *path);
+void	fs_sync(void);
+
+/* int	map_block(uint32_t); */
+bool	block_is_free(uint32_t blockno);
+uint32_t free_block_count(void);
+
+/* test.c */
+void	fs_test(void);
+
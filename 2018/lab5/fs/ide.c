@@ -0,0 +1,322 @@
+/*
+ * Minimal PIO-based (non-interrupt-driven) IDE driver code,
+ * plus bus-master DMA through the PIIX controller when there is one.
+ * A DMA transfer can also be started and left to run, with the disk
+ * interrupt delivered as NOTIFY_DISK; see ide_dma_start().
+ * For information about what all this IDE/ATA magic means,
+ * see the materials available on the class references page.
+ */
+
+#include "fs.h"
+#include <inc/x86.h>
+
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_ERR		0x01
+
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_WRITE		0x30
+#define IDE_CMD_READ_DMA	0xC8
+#define IDE_CMD_WRITE_DMA	0xCA
+
+// Bus-master registers of the primary channel, relative to BAR4
+#define BM_CMD		0
+#define BM_CMD_START	0x01	// start the transfer
+#define BM_CMD_TOMEM	0x08	// the controller writes memory (disk reads)
+#define BM_STATUS	2
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR	0x02	// write 1 to clear
+#define BM_STATUS_IRQ	0x04	// the drive raised its interrupt; write 1 to clear
+#define BM_PRDT		4	// physical address of the PRD table
+
+// Physical Region Descriptor: one physically contiguous piece of a
+// DMA buffer.  The table may not cross a 64KB boundary; one page-aligned
+// page never does.
+struct IdePrd {
+	uint32_t prd_addr;	// physical address
+	uint16_t prd_count;	// bytes, 0 means 64KB
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000	// last entry in the table
+
+static int diskno = 1;
+
+static uint32_t bmbase;		// bus-master register base, 0 to use PIO
+static bool dma_busy;		// a transfer is in progress
+static physaddr_t prdpa;	// physical address of prdtab
+static struct IdePrd prdtab[PGSIZE / sizeof(struct IdePrd)]
+	__attribute__((aligned(PGSIZE)));
+
+static int
+ide_wait_ready(bool check_error)
+{
+	int r;
+
+	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+
+	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
+		return -1;
+	return 0;
+}
+
+bool
+ide_probe_disk1(void)
+{
+	int r, x;
+
+	// wait for Device 0 to be ready
+	ide_wait_ready(0);
+
+	// switch to Device 1
+	outb(0x1F6, 0xE0 | (1<<4));
+
+	// check for Device 1 to be ready for a while
+	for (x = 0;
+	     x < 1000 && ((r = inb(0x1F7)) & (IDE_BSY|IDE_DF|IDE_ERR)) != 0;
+	     x++)
+		/* do nothing */;
+
+	// switch back to Device 0
+	outb(0x1F6, 0xE0 | (0<<4));
+
+	cprintf("Device 1 presence: %d\n", (x < 1000));
+	return (x < 1000);
+}
+
+void
+ide_set_disk(int d)
+{
+	if (d != 0 && d != 1)
+		panic("bad disk number");
+	diskno = d;
+}
+
+// Use bus-master DMA from now on, if the kernel found a PIIX
+// controller.  Otherwise keep using PIO.
+void
+ide_dma_init(void)
+{
+	int base, r;
+
+	if ((base = sys_ide_bmbase()) < 0) {
+		cprintf("IDE: no bus-master DMA (%e), using PIO\n", base);
+		return;
+	}
+	prdtab[0].prd_flags = 0;	// make sure the page is there
+	if ((r = sys_page_paddr(prdtab)) < 0)
+		panic("ide_dma_init: sys_page_paddr: %e", r);
+	prdpa = r;
+	bmbase = base;
+
+	// Have the disk interrupt wake us up when a transfer finishes
+	if ((r = sys_notify_bind(NOTIFY_DISK)) < 0)
+		panic("ide_dma_init: sys_notify_bind: %e", r);
+	cprintf("IDE: using bus-master DMA\n");
+}
+
+// Send a command for 'nsecs' sectors starting at 'secno' to the
+// current disk.
+static void
+ide_command(uint32_t secno, size_t nsecs, uint8_t cmd)
+{
+	ide_wait_ready(0);
+
+	outb(0x1F2, nsecs);
+	outb(0x1F3, secno & 0xFF);
+	outb(0x1F4, (secno >> 8) & 0xFF);
+	outb(0x1F5, (secno >> 16) & 0xFF);
+	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
+	outb(0x1F7, cmd);
+}
+
+int
+ide_read_pio(uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	assert(nsecs <= 256);
+
+	ide_command(secno, nsecs, IDE_CMD_READ);
+
+	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
+
+	return 0;
+}
+
+int
+ide_write_pio(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	assert(nsecs <= 256);
+
+	ide_command(secno, nsecs, IDE_CMD_WRITE);
+
+	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		outsl(0x1F0, src, SECTSIZE/4);
+	}
+
+	return 0;
+}
+
+// Start transferring 'nsecs' sectors between the disk and the buffer at
+// 'va' with one bus-master DMA command, and return without waiting.
+// The buffer needs to be mapped but not physically contiguous: the PRD
+// table gets an entry for each page it touches, so a run of block cache
+// pages goes in a single command.  Only one transfer can be in progress;
+// check on it with ide_dma_done().
+//
+// Returns 0 on success, -E_NOT_SUPP if there's no DMA controller, or
+// the sys_page_paddr error if the buffer isn't mapped.
+int
+ide_dma_start(uint32_t secno, void *va, size_t nsecs, bool write)
+{
+	uint32_t n, len;
+	int i, r;
+
+	if (!bmbase)
+		return -E_NOT_SUPP;
+	assert(!dma_busy && nsecs <= 256);
+
+	// Fill in the PRD table.  256 sectors touch at most 33 pages.
+	i = 0;
+	for (n = nsecs * SECTSIZE; n > 0; n -= len, va += len) {
+		len = MIN(n, PGSIZE - PGOFF(va));
+		if ((r = sys_page_paddr(va)) < 0)
+			return r;
+		prdtab[i].prd_addr = r;
+		prdtab[i].prd_count = len;
+		prdtab[i].prd_flags = 0;
+		i++;
+	}
+	prdtab[i - 1].prd_flags = PRD_EOT;
+
+	// Set up the controller, give the drive the command, then start
+	// the controller, in that order.
+	outb(bmbase + BM_CMD, 0);
+	outl(bmbase + BM_PRDT, prdpa);
+	outb(bmbase + BM_STATUS, inb(bmbase + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+	ide_command(secno, nsecs, write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+	outb(bmbase + BM_CMD, BM_CMD_START | (write ? 0 : BM_CMD_TOMEM));
+
+	dma_busy = 1;
+	return 0;
+}
+
+// Is the transfer started by ide_dma_start() still going?
+bool
+ide_dma_busy(void)
+{
+	return dma_busy;
+}
+
+// Check on the transfer started by ide_dma_start().  If it has
+// finished, returns 1 and sets *result to 0, or to -1 if the transfer
+// failed; otherwise returns 0.
+bool
+ide_dma_done(int *result)
+{
+	int st, r;
+
+	assert(dma_busy);
+	if (!((st = inb(bmbase + BM_STATUS)) & (BM_STATUS_IRQ | BM_STATUS_ERR)))
+		return 0;
+
+	// Stop the controller and acknowledge the drive's interrupt.  The
+	// kernel reads the drive status too when the interrupt comes in,
+	// so the drive's error bits may already be gone; the controller's
+	// aren't.
+	outb(bmbase + BM_CMD, 0);
+	r = inb(0x1F7);
+	outb(bmbase + BM_STATUS, st | BM_STATUS_ERR | BM_STATUS_IRQ);
+	dma_busy = 0;
+
+	*result = ((st & BM_STATUS_ERR) || (r & (IDE_DF|IDE_ERR))) ? -1 : 0;
+	return 1;
+}
+
+// Like ide_dma_start(), but wait for the transfer to finish by polling
+// the bus-master status.
+int
+ide_dma(uint32_t secno, void *va, size_t nsecs, bool write)
+{
+	int r;
+
+	if ((r = ide_dma_start(secno, va, nsecs, write)) < 0)
+		return r;
+	while (!ide_dma_done(&r))
+		/* do nothing */;
+	return r;
+}
+
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	if (bmbase)
+		return ide_dma(secno, dst, nsecs, 0);
+	return ide_read_pio(secno, dst, nsecs);
+}
+
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	if (bmbase)
+		return ide_dma(secno, (void *) src, nsecs, 1);
+	return ide_write_pio(secno, src, nsecs);
+}
+
+// Compare PIO and DMA by reading the first megabyte of the disk
+// sequentially, a full 256-sector command at a time, both ways.
+#define BENCHVA		((char *) 0x0f000000)
+#define BENCH_BYTES	(1024 * 1024)
+#define BENCH_SECS	256
+
+void
+ide_bench(void)
+{
+	char *pio = BENCHVA, *dma = BENCHVA + BENCH_SECS * SECTSIZE;
+	uint64_t t, pio_usec = 0, dma_usec = 0;
+	uint32_t secno;
+	int i, r;
+
+	if (!bmbase) {
+		cprintf("ide_bench: no bus-master DMA to compare with\n");
+		return;
+	}
+
+	for (i = 0; i < 2 * BENCH_SECS * SECTSIZE; i += PGSIZE)
+		if ((r = sys_page_alloc(0, BENCHVA + i, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("ide_bench: sys_page_alloc: %e", r);
+
+	for (secno = 0; secno < BENCH_BYTES / SECTSIZE; secno += BENCH_SECS) {
+		t = sys_time_usec();
+		if ((r = ide_read_pio(secno, pio, BENCH_SECS)) < 0)
+			panic("ide_bench: PIO read of sector %d failed", secno);
+		pio_usec += sys_time_usec() - t;
+
+		t = sys_time_usec();
+		if ((r = ide_dma(secno, dma, BENCH_SECS, 0)) < 0)
+			panic("ide_bench: DMA read of sector %d failed", secno);
+		dma_usec += sys_time_usec() - t;
+
+		if (memcmp(pio, dma, BENCH_SECS * SECTSIZE) != 0)
+			panic("ide_bench: PIO and DMA disagree after sector %d", secno);
+	}
+
+	for (i = 0; i < 2 * BENCH_SECS * SECTSIZE; i += PGSIZE)
+		sys_page_unmap(0, BENCHVA + i);
+
+	pio_usec = MAX(pio_usec, 1);
+	dma_usec = MAX(dma_usec, 1);
+	cprintf("ide_bench: 1MB sequential read: PIO %u us (%u KB/s), DMA %u us (%u KB/s)\n",
+		(uint32_t) pio_usec, (uint32_t) (1024 * 1000000ULL / pio_usec),
+		(uint32_t) dma_usec, (uint32_t) (1024 * 1000000ULL / dma_usec));
+}
@@ -11,6 +11,9 @@
 
 #define debug 0
 
+// Set to 1 to compare PIO and DMA disk reads at boot
+#define bench 0
+
 // The file system server maintains three structures
 // for each open file.
 //
@@ -34,6 +37,11 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+
+	// Sequential read-ahead state
+	off_t o_ra_pos;		// offset the previous read ended at
+	uint32_t o_ra_window;	// blocks to keep ahead of the reader, 0 if off
+	uint32_t o_ra_end;	// first file block not read ahead yet
 };
 
 // Max number of open files in the file system at once
@@ -45,8 +53,35 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
-// Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Requests are received on an IPC endpoint, so several of them can be
+// outstanding at once: a handler that can't answer right away calls
+// serve_defer() and the reply is sent later with serve_reply().  Each
+// outstanding request keeps its own argument page and reply capability
+// in a request slot.
+#define NREQSLOT	16
+
+// Virtual address at which to receive page mappings containing client
+// requests; slot i's argument page lives at REQVA + i * PGSIZE.
+#define REQVA		0x0fff0000
+
+struct ReqSlot {
+	bool rs_busy;		// received, not yet replied to
+	bool rs_diskwait;	// deferred until the disk is idle again
+	bool rs_retry;		// the handler has run before and deferred
+	envid_t rs_whom;	// reply capability (the caller's envid)
+	uint32_t rs_req;	// request code
+	union Fsipc *rs_ipc;	// argument page
+};
+
+struct ReqSlot reqslots[NREQSLOT];
+
+// Endpoint clients call, and the slot of the request being handled.
+int32_t fsep;
+static struct ReqSlot *curslot;
+static bool deferred;
+static int ndiskwait;		// slots with rs_diskwait set
+
+static void serve_wait_disk(void);
 
 void
 serve_init(void)
@@ -58,6 +93,8 @@ serve_init(void)
 		opentab[i].o_fd = (struct Fd*) va;
 		va += PGSIZE;
 	}
+	for (i = 0; i < NREQSLOT; i++)
+		reqslots[i].rs_ipc = (union Fsipc *) (REQVA + i * PGSIZE);
 }
 
 // Allocate an open file.
@@ -133,6 +170,8 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 				cprintf("file_create failed: %e", r);
 			return r;
 		}
+		if (req->req_omode & O_MKDIR)
+			f->f_type = FTYPE_DIR;
 	} else {
 try_open:
 		if ((r = file_open(path, &f)) < 0) {
@@ -158,6 +197,9 @@ try_open:
 
 	// Save the file pointer
 	o->o_file = f;
+	o->o_ra_pos = 0;
+	o->o_ra_window = 0;
+	o->o_ra_end = 0;
 
 	// Fill out the Fd structure
 	o->o_fd->fd_file.id = o->o_fileid;
@@ -200,6 +242,38 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 	return file_set_size(o->o_file, req->req_size);
 }
 
+// Read ahead of a read of n bytes at 'offset' in o.  A read that
+// starts where the previous one ended doubles the window, up to
+// RA_MAXBLOCKS; any other read turns read-ahead off until the reads
+// look sequential again.  The next batch is read once the reader is
+// within half a window of the end of the last one, and starts with
+// the block being read now, so a miss there is part of the batch.
+static void
+serve_readahead(struct OpenFile *o, off_t offset, size_t n)
+{
+	uint32_t first, last;
+
+	if (n == 0)
+		return;
+	if (offset != o->o_ra_pos) {
+		o->o_ra_window = 0;
+		o->o_ra_end = 0;
+		return;
+	}
+	if (o->o_ra_window == 0)
+		o->o_ra_window = RA_MINBLOCKS;
+	else
+		o->o_ra_window = MIN(o->o_ra_window * 2, RA_MAXBLOCKS);
+
+	first = offset / BLKSIZE;
+	last = (offset + n - 1) / BLKSIZE;
+	if (last + o->o_ra_window / 2 < o->o_ra_end)
+		return;
+	first = MAX(first, o->o_ra_end);
+	o->o_ra_end = file_readahead(o->o_file, first,
+				     last + 1 + o->o_ra_window - first);
+}
+
 // Read at most ipc->read.req_n bytes from the current seek position
 // in ipc->read.req_fileid.  Return the bytes read from the file to
 // the caller in ipc->readRet, then update the seek position.  Returns
@@ -216,12 +290,27 @@ serve_read(envid_t envid, union Fsipc *ipc)
 	// Lab 5: Your code here:
 	int r;
 	struct OpenFile *po;
+	uint32_t diskbno;
+	size_t n;
 	
 	if ((r = openfile_lookup(envid, req->req_fileid, &po)) < 0)
 		return r;
+	n = MIN(req->req_n, PGSIZE);
+	if (!curslot->rs_retry)
+		serve_readahead(po, po->o_fd->fd_offset, n);
+
+	// Rather than make every other client wait while a block comes in
+	// from disk, come back to this request once it's there.
+	if ((diskbno = file_read_miss(po->o_file, po->o_fd->fd_offset, n)) != 0
+	    && bc_fetch(diskbno) == 0) {
+		serve_wait_disk();
+		return 0;
+	}
+
 	if ((r = file_read(po->o_file, ret->ret_buf, req->req_n, po->o_fd->fd_offset)) < 0)
 		return r;
 	po->o_fd->fd_offset += r;
+	po->o_ra_pos = po->o_fd->fd_offset;
 	return r;
 }
 
@@ -294,6 +383,75 @@ serve_sync(envid_t envid, union Fsipc *req)
 	return 0;
 }
 
+// Return the block cache statistics in ipc->bcstatRet.
+int
+serve_bcstat(envid_t envid, union Fsipc *ipc)
+{
+	bc_stat(&ipc->bcstatRet);
+	ipc->bcstatRet.bs_disk_blocks = super->s_nblocks;
+	ipc->bcstatRet.bs_free_blocks = free_block_count();
+	return 0;
+}
+
+// Count the blocks of req->req_fileid and the extents they make up.
+int
+serve_extents(envid_t envid, union Fsipc *ipc)
+{
+	struct Fsreq_extents *req = &ipc->extents;
+	struct Fsret_extents *ret = &ipc->extentsRet;
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_extents %08x %08x\n", envid, req->req_fileid);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	file_extents(o->o_file, &ret->ret_nblocks, &ret->ret_nextents);
+	return 0;
+}
+
+// Called by a handler that can't answer the current request yet.
+// Returns the slot to pass to serve_reply() once the answer is known;
+// until then the slot and its argument page stay reserved.
+struct ReqSlot *
+serve_defer(void)
+{
+	deferred = 1;
+	return curslot;
+}
+
+// Called by a handler that needs a block bc_fetch() is bringing in.
+// The request is deferred and its handler runs again from the top once
+// the disk is idle; the handler can tell from curslot->rs_retry.
+static void
+serve_wait_disk(void)
+{
+	serve_defer()->rs_diskwait = 1;
+	ndiskwait++;
+}
+
+// Send the reply for the request in 'slot' and free the slot.
+void
+serve_reply(struct ReqSlot *slot, int r, void *pg, int perm)
+{
+	ep_reply(slot->rs_whom, r, pg, perm);
+	sys_page_unmap(0, slot->rs_ipc);
+	slot->rs_busy = 0;
+	slot->rs_retry = 0;
+}
+
+static struct ReqSlot *
+reqslot_alloc(void)
+{
+	int i;
+
+	for (i = 0; i < NREQSLOT; i++)
+		if (!reqslots[i].rs_busy)
+			return &reqslots[i];
+	return NULL;
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
@@ -304,22 +462,91 @@ fshandler handlers[] = {
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_BCSTAT] =	serve_bcstat,
+	[FSREQ_EXTENTS] =	serve_extents
 };
 
+// Run the handler for the request in 'slot', and reply unless it
+// deferred the request.
+static void
+serve_dispatch(struct ReqSlot *slot)
+{
+	void *pg = NULL;
+	int perm = 0, r;
+
+	curslot = slot;
+	deferred = 0;
+	if (slot->rs_req == FSREQ_OPEN) {
+		r = serve_open(slot->rs_whom, (struct Fsreq_open*)slot->rs_ipc, &pg, &perm);
+	} else if (slot->rs_req < ARRAY_SIZE(handlers) && handlers[slot->rs_req]) {
+		r = handlers[slot->rs_req](slot->rs_whom, slot->rs_ipc);
+	} else {
+		cprintf("Invalid request code %d from %08x\n", slot->rs_req, slot->rs_whom);
+		r = -E_INVAL;
+	}
+	if (!deferred)
+		serve_reply(slot, r, pg, perm);
+}
+
+// The disk is idle again: run the requests that were waiting for it.
+static void
+serve_retry(void)
+{
+	int i;
+
+	for (i = 0; i < NREQSLOT; i++) {
+		if (!reqslots[i].rs_busy || !reqslots[i].rs_diskwait)
+			continue;
+		reqslots[i].rs_diskwait = 0;
+		reqslots[i].rs_retry = 1;
+		ndiskwait--;
+		serve_dispatch(&reqslots[i]);
+	}
+}
+
 void
 serve(void)
 {
-	uint32_t req, whom;
-	int perm, r;
-	void *pg;
+	struct ReqSlot *slot;
+	int32_t req;
+	envid_t whom;
+	uint32_t timeout;
+	int perm;
+
+	if ((fsep = sys_ep_create()) < 0)
+		panic("serve: sys_ep_create: %e", fsep);
 
 	while (1) {
+		// Whether NOTIFY_DISK said so or some synchronous disk access
+		// waited for it, once the disk is idle the requests waiting
+		// for it can go again.
+		if (ndiskwait > 0 && bc_io_poll())
+			serve_retry();
+
+		// Write back blocks that have been dirty long enough, and
+		// find out when to come back for the rest.
+		timeout = bc_writeback_aged();
+
+		if (!(slot = reqslot_alloc())) {
+			// Everything is waiting for the disk
+			sys_notify_wait(NOTIFY_DISK, 0);
+			continue;
+		}
+
+		// While there's nothing else to wait for we can block in
+		// ep_recv; otherwise wait for a call, the disk or the
+		// flusher's timeout, whichever is first.
 		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		if (ndiskwait == 0 && timeout == 0)
+			req = ep_recv(fsep, slot->rs_ipc, &whom, &perm);
+		else if ((req = ep_try_recv(fsep, slot->rs_ipc, &whom, &perm)) == -E_TIMEOUT) {
+			sys_notify_wait(NOTIFY_IPC | (ndiskwait ? NOTIFY_DISK : 0), timeout);
+			continue;
+		}
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
-				req, whom, uvpt[PGNUM(fsreq)], fsreq);
+				req, whom, uvpt[PGNUM(slot->rs_ipc)], slot->rs_ipc);
 
 		// All requests must contain an argument page
 		if (!(perm & PTE_P)) {
@@ -328,17 +555,10 @@ serve(void)
 			continue; // just leave it hanging...
 		}
 
-		pg = NULL;
-		if (req == FSREQ_OPEN) {
-			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
-		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
-			r = handlers[req](whom, fsreq);
-		} else {
-			cprintf("Invalid request code %d from %08x\n", req, whom);
-			r = -E_INVAL;
-		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
+		slot->rs_busy = 1;
+		slot->rs_whom = whom;
+		slot->rs_req = req;
+		serve_dispatch(slot);
 	}
 }
 
@@ -355,6 +575,8 @@ umain(int argc, char **argv)
 
 	serve_init();
 	fs_init();
+	if (bench)
+		ide_bench();
         fs_test();
 	serve();
 }
@@ -6,6 +6,7 @@
 #include <inc/string.h>
 #include <inc/assert.h>
 #include <inc/elf.h>
+#include <inc/vdso.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -14,6 +15,10 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/endpoint.h>
+#include <kern/ipctrace.h>
+#include <kern/timer.h>
+#include <kern/ktrace.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
@@ -203,9 +208,37 @@ env_setup_vm(struct Env *e)
 	// Permissions: kernel R, user R
 	e->env_pgdir[PDX(UVPT)] = PADDR(e->env_pgdir) | PTE_P | PTE_U;
 
+	// Give the env its own copy of the UENVS page table, with its own
+	// identity page at UVDSO_ENV (see inc/vdso.h).  env_alloc fills it in.
+	struct PageInfo *pt, *id;
+	pte_t *ptva;
+
+	if (!(pt = page_alloc(0)) || !(id = page_alloc(ALLOC_ZERO))) {
+		if (pt)
+			page_free(pt);
+		page_decref(p);
+		e->env_pgdir = 0;
+		return -E_NO_MEM;
+	}
+	pt->pp_ref++;
+	id->pp_ref++;
+	ptva = page2kva(pt);
+	memcpy(ptva, KADDR(PTE_ADDR(kern_pgdir[PDX(UENVS)])), PGSIZE);
+	ptva[PTX(UVDSO_ENV)] = page2pa(id) | PTE_P | PTE_U;
+	e->env_pgdir[PDX(UENVS)] = page2pa(pt) | PTE_P | PTE_U;
+
 	return 0;
 }
 
+// Return the kernel address of e's identity page at UVDSO_ENV.
+static struct VdsoEnv *
+env_vdso(struct Env *e)
+{
+	pte_t *pt = KADDR(PTE_ADDR(e->env_pgdir[PDX(UVDSO_ENV)]));
+
+	return KADDR(PTE_ADDR(pt[PTX(UVDSO_ENV)]));
+}
+
 //
 // Allocates and initializes a new environment.
 // On success, the new environment is stored in *newenv_store.
@@ -233,6 +266,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	if (generation <= 0)	// Don't create a negative env_id.
 		generation = 1 << ENVGENSHIFT;
 	e->env_id = generation | (e - envs);
+	env_vdso(e)->ve_id = e->env_id;
 
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
@@ -270,6 +304,23 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_ipc_dstpages = 0;
+	e->env_ipc_npages = 0;
+
+	// No notifications yet.
+	e->env_notify_pending = 0;
+	e->env_notify_mask = 0;
+
+	// No timer armed.
+	e->env_timeout = 0;
+	e->env_timer_link = NULL;
+	e->env_timer_pprev = NULL;
+
+	// Not serving or calling any endpoint.
+	e->env_ep = 0;
+	e->env_ep_calling = 0;
+	e->env_ep_accepted = 0;
+	e->env_ep_link = NULL;
 
 	// commit the allocation
 	env_free_list = e->env_link;
@@ -447,6 +498,12 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
 
+	// Fail calls to its endpoint and leave any endpoint queue it's on.
+	ep_env_free(e);
+
+	// Don't leave it in the timer queue.
+	timer_cancel(e);
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
@@ -473,6 +530,12 @@ env_free(struct Env *e)
 		page_decref(pa2page(pa));
 	}
 
+	// free the identity page and the private copy of the UENVS page table
+	pt = KADDR(PTE_ADDR(e->env_pgdir[PDX(UENVS)]));
+	page_decref(pa2page(PTE_ADDR(pt[PTX(UVDSO_ENV)])));
+	page_decref(pa2page(PTE_ADDR(e->env_pgdir[PDX(UENVS)])));
+	e->env_pgdir[PDX(UENVS)] = 0;
+
 	// free the page directory
 	pa = PADDR(e->env_pgdir);
 	e->env_pgdir = 0;
@@ -536,6 +599,43 @@ env_pop_tf(struct Trapframe *tf)
 	panic("iret failed");  /* mostly to placate the compiler */
 }
 
+//
+// Return to the current environment after a system call that entered
+// through sysenter, restoring the registers in 'tf' except %ecx and
+// %edx, which sysexit uses for the user %esp and %eip.  The user stub
+// expects those two to be clobbered.  Much cheaper than iret.
+//
+// This function does not return.
+//
+void
+env_sysexit(struct Trapframe *tf)
+{
+	curenv->env_cpunum = cpunum();
+
+	unlock_kernel();
+
+	asm volatile(
+		"\tmovl %0,%%esp\n"
+		"\tpopal\n"
+		"\tpopl %%es\n"
+		"\tpopl %%ds\n"
+		/* Restore tf_eflags, except IF (set by the sti below, so
+		 * nothing interrupts us on this stack) and TF (sysexit
+		 * can't return with it).  The stack below tf isn't ours to
+		 * push on, so popfl from the tf_err slot. */
+		"\tmovl 0x10(%%esp),%%edx\n"	/* tf_eflags */
+		"\tandl %1,%%edx\n"
+		"\tmovl %%edx,0x4(%%esp)\n"	/* tf_err */
+		"\taddl $0x4,%%esp\n"
+		"\tpopfl\n"
+		"\tmovl 0x0(%%esp),%%edx\n"	/* tf_eip */
+		"\tmovl 0xc(%%esp),%%ecx\n"	/* tf_esp */
+		"\tsti\n"			/* takes effect after sysexit */
+		"\tsysexit\n"
+		: : "g" (tf), "i" (~(FL_IF | FL_TF)) : "memory");
+	panic("sysexit failed");  /* mostly to placate the compiler */
+}
+
 //
 // Context switch from curenv to env e.
 // Note: if this is the first call to env_run, curenv is NULL.
@@ -570,6 +670,8 @@ env_run(struct Env *e)
 	curenv = e;
 	e->env_status = ENV_RUNNING;
 	e->env_runs++;
+	ipctrace_wake(e);
+	TRACE(KT_ENV_RUN, e->env_id, e->env_runs);
 	lcr3(PADDR(e->env_pgdir));
 	env_pop_tf(&(e->env_tf));
 }
@@ -4,6 +4,9 @@
 
 #define debug 0
 
+// How long fsipc waits for the file server to show up before giving up.
+#define FSIPC_WAIT_MS	10000
+
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
 // Send an inter-environment request to the file server, and wait for
@@ -15,17 +18,29 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 static int
 fsipc(unsigned type, void *dstva)
 {
-	static envid_t fsenv;
-	if (fsenv == 0)
-		fsenv = ipc_find_env(ENV_TYPE_FS);
+	static int32_t fsep;
+	unsigned start;
+
+	// The file server creates its endpoint once it's done fs_init.
+	// Time the wait rather than count yields: sys_yield comes straight
+	// back when nothing else is runnable, e.g. while the server sleeps
+	// on the disk.
+	if (fsep == 0) {
+		start = sys_time_msec();
+		while ((fsep = ep_find(ENV_TYPE_FS)) == 0) {
+			if (sys_time_msec() - start > FSIPC_WAIT_MS)
+				panic("fsipc: no file server endpoint after %d ms",
+				      FSIPC_WAIT_MS);
+			sys_yield();
+		}
+	}
 
 	static_assert(sizeof(fsipcbuf) == PGSIZE);
 
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ep_call(fsep, type, &fsipcbuf, PTE_P | PTE_W | PTE_U, dstva);
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -186,3 +201,35 @@ sync(void)
 	return fsipc(FSREQ_SYNC, NULL);
 }
 
+
+// Fetch the file server's block cache statistics.
+int
+bcstat(struct BcStat *st)
+{
+	int r;
+
+	if ((r = fsipc(FSREQ_BCSTAT, NULL)) < 0)
+		return r;
+	*st = fsipcbuf.bcstatRet;
+	return 0;
+}
+
+// Count the blocks of open file 'fdnum' and the extents, runs of blocks
+// that are contiguous on disk, that they make up.
+int
+fextents(int fdnum, uint32_t *nblocks, uint32_t *nextents)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	fsipcbuf.extents.req_fileid = fd->fd_file.id;
+	if ((r = fsipc(FSREQ_EXTENTS, NULL)) < 0)
+		return r;
+	*nblocks = fsipcbuf.extentsRet.ret_nblocks;
+	*nextents = fsipcbuf.extentsRet.ret_nextents;
+	return 0;
+}
@@ -56,31 +56,28 @@ pgfault(struct UTrapframe *utf)
 // copy-on-write again if it was already copy-on-write at the beginning of
 // this function?)
 //
-// Returns: 0 on success, < 0 on error.
-// It is also OK to panic on error.
+// The mappings are queued on the syscall ring; errors show up at the
+// next sysring_flush().
 //
-static int
-duppage(envid_t ceid, unsigned pn)
+static void
+duppage(envid_t peid, envid_t ceid, unsigned pn)
 {
 	// LAB 4: Your code here.
-	int r;
 	extern volatile pte_t uvpt[];
-	envid_t peid = sys_getenvid();
-	intptr_t va = (intptr_t)(pn * PGSIZE);
+	uintptr_t va = pn * PGSIZE;
 
 	if (uvpt[pn] & PTE_SHARE) {
-		if ((r = sys_page_map(peid, (void *)va, ceid, (void *)va, uvpt[pn] & PTE_SYSCALL)) < 0)
-			return r;
+		sysring_push(SYS_page_map, peid, va, ceid, va, uvpt[pn] & PTE_SYSCALL);
 	} else if (uvpt[pn] & (PTE_COW|PTE_W)) {
-		if ((r = sys_page_map(peid, (void *)va, ceid, (void *)va, (PTE_COW|PTE_U))) < 0)
-			return r;
-		if ((r = sys_page_map(peid, (void *)va, peid, (void *)va, (PTE_COW|PTE_U))) < 0)
-			return r;
+		// Both halves must run in the same batch: if we got to run
+		// in between, we could write to the page after the child
+		// got its copy-on-write mapping of it.
+		sysring_reserve(2);
+		sysring_push(SYS_page_map, peid, va, ceid, va, (PTE_COW|PTE_U));
+		sysring_push(SYS_page_map, peid, va, peid, va, (PTE_COW|PTE_U));
 	} else {
-		if ((r = sys_page_map(peid, (void *)va, ceid, (void *)va, PTE_U)) < 0)
-			return r;
+		sysring_push(SYS_page_map, peid, va, ceid, va, PTE_U);
 	}
-	return 0;
 }
 
 //
@@ -104,6 +101,7 @@ fork(void)
 {
 	// LAB 4: Your code here.
 	int rc;
+	envid_t peid = thisenv->env_id;
 
 	set_pgfault_handler(pgfault);
 	
@@ -140,21 +138,25 @@ fork(void)
 		}
 		// all other pages should be duppage()ed.
 		// writable and COW pages willed be handled differently by duppage().
-		if ((rc = duppage(ceid, (unsigned)(va/PGSIZE))) < 0)
-			return rc;
+		duppage(peid, ceid, (unsigned)(va/PGSIZE));
 		va += PGSIZE;
 	}
 
 	// let the parent set the exception stack for the child.
 	// the child may immediately cause a page fault when it's run,
 	// and if don't have a uxstack for the child by then, we're doomed.
-	if ((rc = sys_page_alloc(ceid, (void *)(UXSTACKTOP-PGSIZE), (PTE_U|PTE_W))) < 0)
-		return rc;
+	sysring_push(SYS_page_alloc, ceid, UXSTACKTOP-PGSIZE, (PTE_U|PTE_W), 0, 0);
 
 	// set up the page fault upcall for the child.
 	// can't simply call set_pgfault_handler twice.
 	extern void _pgfault_upcall(void);
-	sys_env_set_pgfault_upcall(ceid, _pgfault_upcall);
+	sysring_push(SYS_env_set_pgfault_upcall, ceid, (uint32_t)_pgfault_upcall, 0, 0, 0);
+
+	// everything above has to have worked before the child may run.
+	if ((rc = sysring_flush()) < 0) {
+		sys_env_destroy(ceid);
+		return rc;
+	}
 
 	// marks the child RUNNABLE.
 	sys_env_set_status(ceid, ENV_RUNNABLE);
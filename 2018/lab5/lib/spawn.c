@@ -9,7 +9,7 @@
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
-static int copy_shared_pages(envid_t child);
+static void copy_shared_pages(envid_t child);
 
 // Spawn a child process from a program image loaded from the file system.
 // prog: the pathname of the program to run.
@@ -126,19 +126,23 @@ spawn(const char *prog, const char **argv)
 	fd = -1;
 
 	// Copy shared library state.
-	if ((r = copy_shared_pages(child)) < 0)
-		panic("copy_shared_pages: %e", r);
+	copy_shared_pages(child);
 
-	child_tf.tf_eflags |= FL_IOPL_3;   // devious: see user/faultio.c
-	if ((r = sys_env_set_trapframe(child, &child_tf)) < 0)
-		panic("sys_env_set_trapframe: %e", r);
+	// Run everything queued so far, so the child's memory is complete
+	// before it can run.
+	if ((r = sysring_flush()) < 0)
+		panic("spawn: setting up child memory: %e", r);
 
-	if ((r = sys_env_set_status(child, ENV_RUNNABLE)) < 0)
-		panic("sys_env_set_status: %e", r);
+	child_tf.tf_eflags |= FL_IOPL_3;   // devious: see user/faultio.c
+	sysring_push(SYS_env_set_trapframe, child, (uint32_t) &child_tf, 0, 0, 0);
+	sysring_push(SYS_env_set_status, child, ENV_RUNNABLE, 0, 0, 0);
+	if ((r = sysring_flush()) < 0)
+		panic("spawn: starting child: %e", r);
 
 	return child;
 
 error:
+	sysring_flush();
 	sys_env_destroy(child);
 	close(fd);
 	return r;
@@ -248,16 +252,9 @@ init_stack(envid_t child, const char **argv, uintptr_t *init_esp)
 
 	// After completing the stack, map it into the child's address space
 	// and unmap it from ours!
-	if ((r = sys_page_map(0, UTEMP, child, (void*) (USTACKTOP - PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
-		goto error;
-	if ((r = sys_page_unmap(0, UTEMP)) < 0)
-		goto error;
-
-	return 0;
-
-error:
-	sys_page_unmap(0, UTEMP);
-	return r;
+	sysring_push(SYS_page_map, 0, (uint32_t) UTEMP, child, USTACKTOP - PGSIZE, PTE_P | PTE_U | PTE_W);
+	sysring_push(SYS_page_unmap, 0, (uint32_t) UTEMP, 0, 0, 0);
+	return sysring_flush();
 }
 
 static int
@@ -276,35 +273,38 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
+	// Blank pages and the map/unmap of each file page are queued on the
+	// syscall ring.  Only the allocation of UTEMP must happen before we
+	// read into it, so it flushes the queue and goes in the same trap.
 	for (i = 0; i < memsz; i += PGSIZE) {
 		if (i >= filesz) {
 			// allocate a blank page
-			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
-				return r;
+			sysring_push(SYS_page_alloc, child, va + i, perm, 0, 0);
 		} else {
 			// from file
-			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			sysring_push(SYS_page_alloc, 0, (uint32_t) UTEMP, PTE_P|PTE_U|PTE_W, 0, 0);
+			if ((r = sysring_flush()) < 0)
 				return r;
 			if ((r = seek(fd, fileoffset + i)) < 0)
 				return r;
 			if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
 				return r;
-			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
-				panic("spawn: sys_page_map data: %e", r);
-			sys_page_unmap(0, UTEMP);
+			sysring_reserve(2);
+			sysring_push(SYS_page_map, 0, (uint32_t) UTEMP, child, va + i, perm);
+			sysring_push(SYS_page_unmap, 0, (uint32_t) UTEMP, 0, 0, 0);
 		}
 	}
 	return 0;
 }
 
 // Copy the mappings for shared pages into the child address space.
-static int
+// The mappings are queued on the syscall ring.
+static void
 copy_shared_pages(envid_t child)
 {
 	// LAB 5: Your code here.
 	extern volatile pde_t uvpd[];
 	extern volatile pte_t uvpt[];
-	int r;
 
 	for (uintptr_t va = 0; va < UTOP;) {
 		if ((uvpd[va >> PDXSHIFT] & PTE_P) == 0) {	// Page table not mapped.
@@ -317,12 +317,9 @@ copy_shared_pages(envid_t child)
 			va += PGSIZE;
 			continue;
 		}
-		if (perm & PTE_SHARE) {
-			if ((r = sys_page_map(thisenv->env_id, (void *)va, child, (void *)va, perm)) < 0)
-				return r;
-		}
+		if (perm & PTE_SHARE)
+			sysring_push(SYS_page_map, thisenv->env_id, va, child, va, perm);
 		va += PGSIZE;
 	}
-	return 0;
 }
 
@@ -0,0 +1,107 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_ENV_H
+#define JOS_INC_ENV_H
+
+#include <inc/types.h>
+#include <inc/trap.h>
+#include <inc/memlayout.h>
+
+typedef int32_t envid_t;
+
+// An environment ID 'envid_t' has three parts:
+//
+// +1+---------------21-----------------+--------10--------+
+// |0|          Uniqueifier             |   Environment    |
+// | |                                  |      Index       |
+// +------------------------------------+------------------+
+//                                       \--- ENVX(eid) --/
+//
+// The environment index ENVX(eid) equals the environment's index in the
+// 'envs[]' array.  The uniqueifier distinguishes environments that were
+// created at different times, but share the same environment index.
+//
+// All real environments are greater than 0 (so the sign bit is zero).
+// envid_ts less than 0 signify errors.  The envid_t == 0 is special, and
+// stands for the current environment.
+
+#define LOG2NENV		10
+#define NENV			(1 << LOG2NENV)
+#define ENVX(envid)		((envid) & (NENV - 1))
+
+// Maximum number of pages that can be granted by a single IPC.
+#define IPC_MAXPAGES		32
+
+// Notification bits, see sys_notify_wait().
+// The low bits are posted by the kernel; the NOTIFY_USER bits are free
+// for environments to signal each other with sys_notify_signal().
+#define NOTIFY_NET		0x00000001	// e1000 received a packet
+#define NOTIFY_DISK		0x00000002	// IDE disk raised an interrupt
+#define NOTIFY_TIMER		0x00000004	// sys_notify_wait() timed out
+#define NOTIFY_IPC		0x00000008	// A sender found us not receiving
+#define NOTIFY_USER		0xffff0000
+
+// Values of env_status in struct Env
+enum {
+	ENV_FREE = 0,
+	ENV_DYING,
+	ENV_RUNNABLE,
+	ENV_RUNNING,
+	ENV_NOT_RUNNABLE
+};
+
+// Special environment types
+enum EnvType {
+	ENV_TYPE_USER = 0,
+	ENV_TYPE_FS,		// File system server
+	ENV_TYPE_NS,		// Network server
+};
+
+struct Env {
+	struct Trapframe env_tf;	// Saved registers
+	struct Env *env_link;		// Next free Env
+	envid_t env_id;			// Unique environment identifier
+	envid_t env_parent_id;		// env_id of this env's parent
+	enum EnvType env_type;		// Indicates special system environments
+	unsigned env_status;		// Status of the environment
+	uint32_t env_runs;		// Number of times environment has run
+	int env_cpunum;			// The CPU that the env is running on
+
+	// Address space
+	pde_t *env_pgdir;		// Kernel virtual address of page dir
+
+	// Exception handling
+	void *env_pgfault_upcall;	// Page fault upcall entry point
+
+	// Lab 4 IPC
+	bool env_ipc_recving;		// Env is blocked receiving
+	void *env_ipc_dstva;		// VA at which to map received page
+	uint32_t env_ipc_value;		// Data value sent to us
+	envid_t env_ipc_from;		// envid of the sender
+	int env_ipc_perm;		// Perm of page mapping received
+
+	// Multi-page IPC
+	size_t env_ipc_dstpages;	// Size of the receive window in pages
+	size_t env_ipc_npages;		// Number of pages actually received
+
+	// Notifications
+	uint32_t env_notify_pending;	// Bits posted but not yet consumed
+	uint32_t env_notify_mask;	// Bits we're blocked on, 0 if not waiting
+
+	// Timeouts
+	uint64_t env_timeout;		// time_usec() at which to stop blocking, 0 if none
+	struct Env *env_timer_link;	// Next env in the same timer wheel slot
+	struct Env **env_timer_pprev;	// Link pointing at us in that slot
+
+	// IPC endpoints
+	int32_t env_ep;			// Endpoint this env serves, 0 if none
+	int32_t env_ep_calling;		// Endpoint we're blocked calling, 0 if none
+	bool env_ep_accepted;		// The server has received our call
+	struct Env *env_ep_link;	// Next caller queued on the same endpoint
+	uint32_t env_ep_value;		// Value of our call
+	void *env_ep_srcva;		// Page sent with our call, -1 if none
+	int env_ep_perm;		// Perm of that page
+	void *env_ep_dstva;		// VA at which to map the reply page
+};
+
+#endif // !JOS_INC_ENV_H
@@ -30,6 +30,8 @@ enum {
 	E_TX_FULL,		// tdr queue is full
 	E_RX_EMPTY,		// rdr queue is empty
 
+	E_TIMEOUT,		// Deadline passed before the event happened
+
 	MAXERROR
 };
 
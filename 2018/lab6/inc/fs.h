@@ -0,0 +1,161 @@
+// See COPYRIGHT for copyright information.
+
+#ifndef JOS_INC_FS_H
+#define JOS_INC_FS_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// File nodes (both in-memory and on-disk)
+
+// Bytes per file system block - same as page size
+#define BLKSIZE		PGSIZE
+#define BLKBITSIZE	(BLKSIZE * 8)
+
+// Maximum size of a filename (a single path component), including null
+// Must be a multiple of 4
+#define MAXNAMELEN	128
+
+// Maximum size of a complete pathname, including null
+#define MAXPATHLEN	1024
+
+// A file's blocks are described by extents: runs of file blocks that
+// are also consecutive on disk.  The first NINLINE extents live in the
+// File itself, the rest in one extent block.
+struct Extent {
+	uint32_t e_fileblock;		// first file block in the run
+	uint32_t e_diskblock;		// disk block it is stored in
+	uint32_t e_len;			// number of blocks in the run
+};
+
+// Number of extents in a File descriptor
+#define NINLINE		9
+// Number of extents in an extent block
+#define NEXTBLOCK	(BLKSIZE / sizeof(struct Extent))
+// Most extents a file can have
+#define NEXTENT		(NINLINE + NEXTBLOCK)
+
+// A file's size is bounded by f_size rather than by its block map,
+// as long as it doesn't need more than NEXTENT runs.
+#define MAXFILESIZE	0x40000000
+
+struct File {
+	char f_name[MAXNAMELEN];	// filename
+	off_t f_size;			// file size in bytes
+	uint32_t f_type;		// file type
+
+	// Block map.
+	// Extents are sorted by e_fileblock and don't overlap; file
+	// blocks not in any extent aren't allocated.
+	uint32_t f_nextents;		// extents in use
+	struct Extent f_extents[NINLINE];	// the first NINLINE extents
+	uint32_t f_extblock;		// block holding the rest, 0 if none
+
+	// Pad out to 256 bytes; must do arithmetic in case we're compiling
+	// fsformat on a 64-bit machine.
+	uint8_t f_pad[256 - MAXNAMELEN - 12 - 12*NINLINE - 4];
+} __attribute__((packed));	// required only on some 64-bit machines
+
+// An inode block contains exactly BLKFILES 'struct File's
+#define BLKFILES	(BLKSIZE / sizeof(struct File))
+
+// File types
+#define FTYPE_REG	0	// Regular file
+#define FTYPE_DIR	1	// Directory
+
+
+// The super-block (both in-memory and on-disk)
+
+#define FS_MAGIC	0x4A0530AF	// related vaguely to 'J\0S!'
+#define FS_MAGIC_BLKPTR	0x4A0530AE	// the format before extents
+
+struct Super {
+	uint32_t s_magic;		// Magic number: FS_MAGIC
+	uint32_t s_nblocks;		// Total number of blocks on disk
+	struct File s_root;		// Root directory node
+};
+
+// Block cache and disk usage statistics, see FSREQ_BCSTAT.
+struct BcStat {
+	uint32_t bs_resident;		// Blocks currently in the cache
+	uint32_t bs_maxblocks;		// Blocks the cache may hold (not counting pinned ones)
+	uint32_t bs_hits;		// Lookups that found the block resident
+	uint32_t bs_misses;		// Blocks read in by the page fault handler
+	uint32_t bs_evictions;		// Blocks dropped to make room
+	uint32_t bs_dirty;		// Blocks currently dirty
+	uint32_t bs_writebacks;		// Dirty blocks written back
+	uint32_t bs_writeruns;		// Disk writes they took, after coalescing
+	uint32_t bs_ra_blocks;		// Blocks read ahead of use
+	uint32_t bs_ra_hits;		// Read-ahead blocks later looked up
+	uint32_t bs_ra_waste;		// Read-ahead blocks evicted without being used
+	uint32_t bs_disk_blocks;	// Blocks on the disk
+	uint32_t bs_free_blocks;	// Blocks on the disk not allocated
+};
+
+// Definitions for requests from clients to file system
+enum {
+	FSREQ_OPEN = 1,
+	FSREQ_SET_SIZE,
+	// Read returns a Fsret_read on the request page
+	FSREQ_READ,
+	FSREQ_WRITE,
+	// Stat returns a Fsret_stat on the request page
+	FSREQ_STAT,
+	FSREQ_FLUSH,
+	FSREQ_REMOVE,
+	FSREQ_SYNC,
+	// Bcstat returns a struct BcStat on the request page
+	FSREQ_BCSTAT,
+	// Extents returns a Fsret_extents on the request page
+	FSREQ_EXTENTS
+};
+
+union Fsipc {
+	struct Fsreq_open {
+		char req_path[MAXPATHLEN];
+		int req_omode;
+	} open;
+	struct Fsreq_set_size {
+		int req_fileid;
+		off_t req_size;
+	} set_size;
+	struct Fsreq_read {
+		int req_fileid;
+		size_t req_n;
+	} read;
+	struct Fsret_read {
+		char ret_buf[PGSIZE];
+	} readRet;
+	struct Fsreq_write {
+		int req_fileid;
+		size_t req_n;
+		char req_buf[PGSIZE - (sizeof(int) + sizeof(size_t))];
+	} write;
+	struct Fsreq_stat {
+		int req_fileid;
+	} stat;
+	struct Fsret_stat {
+		char ret_name[MAXNAMELEN];
+		off_t ret_size;
+		int ret_isdir;
+	} statRet;
+	struct Fsreq_flush {
+		int req_fileid;
+	} flush;
+	struct Fsreq_remove {
+		char req_path[MAXPATHLEN];
+	} remove;
+	struct BcStat bcstatRet;
+	struct Fsreq_extents {
+		int req_fileid;
+	} extents;
+	struct Fsret_extents {
+		uint32_t ret_nblocks;
+		uint32_t ret_nextents;
+	} extentsRet;
+
+	// Ensure Fsipc is one page
+	char _pad[PGSIZE];
+};
+
+#endif /* !JOS_INC_FS_H */
@@ -0,0 +1,26 @@
+#ifndef JOS_INC_KTRACE_H
+#define JOS_INC_KTRACE_H
+
+// Kernel trace event types, see kern/ktrace.c.
+// Each event carries two words of arguments.
+enum {
+	KT_ENV_RUN = 0,		// a0 = env id
+	KT_SCHED,		// a0 = env that was running, 0 if none
+	KT_TRAP,		// a0 = trap number, a1 = eip
+	KT_SYSCALL,		// a0 = syscall number, a1 = first argument
+	KT_SYSRET,		// a0 = syscall number, a1 = return value
+	KT_PAGE_ALLOC,		// a0 = physical address
+	KT_PAGE_FREE,		// a0 = physical address
+	KT_TX_PKT,		// a0 = length
+	KT_RX_PKT,		// a0 = length
+	KT_USER,		// from sys_ktrace(): a0 = KTU_* code, a1 = argument
+	NKTRACE
+};
+
+// Codes environments log with sys_ktrace()
+enum {
+	KTU_BC_PGFAULT = 1,	// a1 = block number
+	KTU_BC_READAHEAD,	// a1 = first block of a read-ahead transfer
+};
+
+#endif	// !JOS_INC_KTRACE_H
@@ -22,6 +22,8 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/prof.h>
+#include <inc/ktrace.h>
 
 #define USED(x)		(void)(x)
 
@@ -59,9 +61,30 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_try_send_range(envid_t to_env, uint32_t value, void *pg, size_t npages, int perm);
+int	sys_ipc_recv_range(void *rcv_pg, size_t npages);
+int	sys_ipc_recv_until(void *rcv_pg, uint64_t deadline);
 unsigned int sys_time_msec(void);
+uint64_t sys_time_usec(void);
+int	sys_sleep_until(uint64_t deadline);
+int	sys_prof_read(envid_t env, struct ProfSample *samples, size_t n);
+int	sys_ktrace(uint32_t code, uint32_t arg);
+int	sys_sysstat(struct SysStat *stats);
+int	sys_ide_bmbase(void);
+int	sys_page_paddr(void *va);
 int sys_tx_pkt(const char *buf, size_t nbytes);
 int sys_rx_pkt(char *buf);
+uint32_t sys_notify_wait(uint32_t mask, unsigned int timeout);
+int	sys_notify_signal(envid_t env, uint32_t bits);
+int	sys_notify_bind(uint32_t bits);
+int32_t	sys_ep_create(void);
+int32_t	sys_ep_call(int32_t epid, uint32_t value, void *pg, int perm, void *rcv_pg);
+int	sys_ep_recv(int32_t epid, void *rcv_pg);
+int	sys_ep_try_recv(int32_t epid, void *rcv_pg);
+int	sys_ep_reply(envid_t caller, int32_t value, void *pg, int perm);
+int	sys_null(void);
+int	sys_sysring_enter(struct Sysring *ring);
+extern bool syscall_use_sysenter;
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -77,7 +100,23 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+		       uint64_t deadline);
+void	ipc_send_range(envid_t to_env, uint32_t value, void *pg, size_t npages, int perm);
+int32_t ipc_recv_range(envid_t *from_env_store, void *pg, size_t npages,
+		       int *perm_store, size_t *npages_store);
 envid_t	ipc_find_env(enum EnvType type);
+int32_t	ep_call(int32_t epid, uint32_t value, void *pg, int perm, void *rcv_pg);
+int32_t	ep_recv(int32_t epid, void *pg, envid_t *from_env_store, int *perm_store);
+int32_t	ep_try_recv(int32_t epid, void *pg, envid_t *from_env_store, int *perm_store);
+void	ep_reply(envid_t caller, int32_t value, void *pg, int perm);
+int32_t	ep_find(enum EnvType type);
+
+// sysring.c
+void	sysring_push(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+		     uint32_t a4, uint32_t a5);
+void	sysring_reserve(int n);
+int	sysring_flush(void);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -100,6 +139,8 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	bcstat(struct BcStat *st);
+int	fextents(int fd, uint32_t *nblocks, uint32_t *nextents);
 
 // pageref.c
 int	pageref(void *addr);
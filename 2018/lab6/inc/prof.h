@@ -0,0 +1,15 @@
+#ifndef JOS_INC_PROF_H
+#define JOS_INC_PROF_H
+
+#include <inc/types.h>
+
+// A sample taken by the profiler on a scheduler tick: where the CPU was
+// when the timer interrupted it.  See kern/prof.c and sys_prof_read().
+struct ProfSample {
+	uintptr_t ps_eip;	// interrupted eip
+	int32_t ps_env;		// env_id of the env running, 0 if none
+	uint16_t ps_cpu;	// CPU the sample was taken on
+	uint16_t ps_user;	// 1 if the CPU was in user mode
+};
+
+#endif	// !JOS_INC_PROF_H
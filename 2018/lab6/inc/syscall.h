@@ -1,6 +1,8 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+
 /* system call numbers */
 enum {
 	SYS_cputs = 0,
@@ -20,7 +22,54 @@ enum {
 	SYS_time_msec,
 	SYS_tx_pkt,
 	SYS_rx_pkt,
+	SYS_ipc_try_send_range,
+	SYS_notify_wait,
+	SYS_notify_signal,
+	SYS_notify_bind,
+	SYS_ep_create,
+	SYS_ep_call,
+	SYS_ep_recv,
+	SYS_ep_reply,
+	SYS_null,
+	SYS_sysring_enter,
+	SYS_sleep_until,
+	SYS_prof_read,
+	SYS_ktrace,
+	SYS_sysstat,
+	SYS_ide_bmbase,
+	SYS_page_paddr,
 	NSYSCALLS
 };
 
+// Batched system calls.  An environment fills entries of a page-aligned
+// struct Sysring between sr_head and sr_tail, then sys_sysring_enter()
+// runs them all in order with a single trap, storing each result in
+// se_ret and advancing sr_head.  Indexes run freely; entry i lives in
+// sr_ent[i % SYSRING_SIZE].
+#define SYSRING_SIZE	128
+
+struct SysringEntry {
+	uint32_t se_num;	// SYS_* number
+	uint32_t se_args[5];
+	int32_t se_ret;		// result, filled in by the kernel
+};
+
+struct Sysring {
+	uint32_t sr_head;	// next entry the kernel will run
+	uint32_t sr_tail;	// next entry the user will fill
+	struct SysringEntry sr_ent[SYSRING_SIZE];
+};
+
+// Per-system-call statistics, see sys_sysstat().  Cycles are TSC cycles
+// spent in the kernel from entry to return; calls that block and return
+// through another path (sys_ipc_recv, sys_yield, ...) are counted in
+// ss_calls but not in ss_timed, and the cycles cover only ss_timed.
+struct SysStat {
+	uint32_t ss_calls;
+	uint32_t ss_timed;	// calls that returned through syscall()
+	uint32_t ss_errors;	// calls that returned < 0
+	uint64_t ss_cycles;	// total over the ss_timed calls
+	uint64_t ss_max;
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -0,0 +1,44 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_INC_VDSO_H
+#define JOS_INC_VDSO_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+
+// Read-only pages the kernel maps into every environment, so that
+// values like the time and the env's own id can be read without a
+// system call.  Both live in the unused tail of the UENVS region:
+//
+//    UENVS + PTSIZE ---> +------------------------------+
+//                        |    struct VdsoEnv (per env)  | R-/R-  PGSIZE
+//    UVDSO_ENV     ----> +------------------------------+
+//                        |    struct Vdso (global)      | R-/R-  PGSIZE
+//    UVDSO         ----> +------------------------------+
+//                        :             ...              :
+//                        |        envs[] (RO copy)      | R-/R-
+//    UENVS         ----> +------------------------------+
+//
+// Every env has its own copy of the UENVS page table so that UVDSO_ENV
+// can map a different page in each.
+
+#define UVDSO		(UENVS + PTSIZE - 2 * PGSIZE)
+#define UVDSO_ENV	(UENVS + PTSIZE - PGSIZE)
+
+// Shared by all environments; updated on every clock tick.
+// The microsecond clock is (read_tsc() - vd_tsc_boot) * 1000 / vd_tsc_khz,
+// see sys_time_usec().
+struct Vdso {
+	uint32_t vd_ticks;	// clock interrupts since boot
+	uint32_t vd_msec;	// time_msec() as of the last tick
+	uint32_t vd_tsc_khz;	// TSC frequency, set once at boot
+	uint64_t vd_tsc_boot;	// TSC value at time zero
+};
+
+// Private to one environment.
+struct VdsoEnv {
+	int32_t ve_id;		// env_id of the environment
+};
+
+#endif /* !JOS_INC_VDSO_H */
@@ -3,8 +3,13 @@
 
 #include <kern/e1000.h>
 #include <kern/pmap.h>
+#include <kern/picirq.h>
+#include <kern/notify.h>
+#include <kern/usercopy.h>
+#include <kern/ktrace.h>
 
 volatile void *e1000;
+int e1000_irq = -1;     /* -1 until the device is attached */
 
 static void rx_init();
 static void tx_init();
@@ -95,15 +100,35 @@ e1000_attach(struct pci_func *pcif)
     
     rx_init();
     tx_init();
+
+    /* Interrupt on packet reception, so ns_input doesn't have to poll */
+    e1000_irq = pcif->irq_line;
+    *(uint32_t *)(e1000 + IMS_OFFSET) = ICR_RXT0;
+    irq_setmask_8259A(irq_mask_8259A & ~(1 << e1000_irq));
     return 0;
 }
 
+/**
+ * e1000_intr - handle an interrupt from e1000
+ *
+ * Reading ICR acknowledges every pending cause.
+ **/
+void
+e1000_intr(void)
+{
+    uint32_t icr = *(uint32_t *)(e1000 + ICR_OFFSET);
+
+    if (icr & ICR_RXT0)
+        notify_irq(NOTIFY_NET);
+}
+
 /**
  * tx_pkt - transmit a packet to Transmit Descriptor Ring (TDR)
- * @buf: buffer to read packet data from
+ * @buf: user buffer to read packet data from
  * @nbytes: size of the packet (in bytes)
  * 
- * Returns zero on success, or -E_TX_FULL if TDR is full.
+ * Returns zero on success, -E_TX_FULL if TDR is full, or -E_FAULT if
+ * @buf is not readable by the user.
  **/
 int
 tx_pkt(const char *buf, size_t nbytes)
@@ -116,8 +141,10 @@ tx_pkt(const char *buf, size_t nbytes)
 	if ((tdr[tdt].status & TDESC_STA_DD) == 0)    /* Still in use */
             return -E_TX_FULL;
     }
-    /* Copy data into packet buffer */
-    memcpy(&tx_pktbufs[tdt], buf, nbytes);
+    /* Copy data into packet buffer; a bad buffer leaves tdt alone */
+    if (copyin(&tx_pktbufs[tdt], buf, nbytes) < 0)
+        return -E_FAULT;
+    TRACE(KT_TX_PKT, nbytes, tdt);
     tdr[tdt].length = (uint16_t)nbytes;
     tdr[tdt].cmd |= TDESC_CMD_RS | TDESC_CMD_EOP;
 
@@ -129,9 +156,10 @@ tx_pkt(const char *buf, size_t nbytes)
 
 /**
  * rx_pkt - receive a packet from Receive Descriptor Ring (RDR)
- * @buf: buffer to write packet data to
+ * @buf: user buffer to write packet data to
  * 
- * Returns length of the packet, or -E_RX_EMPTY if RDR is empty.
+ * Returns length of the packet, -E_RX_EMPTY if RDR is empty, or -E_FAULT
+ * if @buf is not writable by the user (the packet stays in the ring).
  **/
 rx_pkt(char *buf)
 {
@@ -140,13 +168,15 @@ rx_pkt(char *buf)
     if ((rdr[next].status & RDESC_STA_DD) == 0)
         return -E_RX_EMPTY;
     
+    /* Copy data out of packet buffer */
+    uint16_t length = rdr[next].length;
+    if (copyout(buf, &rx_pktbufs[next], length) < 0)
+        return -E_FAULT;
+
+    TRACE(KT_RX_PKT, length, next);
     rdt = next;
     pkt_count++;
     
-    /* Copy data out of packet buffer */
-    uint16_t length = rdr[rdt].length;
-    memcpy(buf, &rx_pktbufs[rdt], length);
-    
     rdr[next].status &= ~RDESC_STA_DD;
     *(uint32_t *)(e1000 + RDT_OFFSET) = rdt;
     return length;
@@ -7,6 +7,9 @@
 int e1000_attach(struct pci_func *pcif);
 int tx_pkt(const char *buf, size_t nbytes);
 int rx_pkt(char *buf);
+void e1000_intr(void);
+
+extern int e1000_irq;
 
 // 3.2.3 Receive Descriptor Format
 struct rd
@@ -75,6 +78,15 @@ struct td
 // 13.4.2 Device Status Register
 #define DSR_OFFSET      0x8
 
+// 13.4.17 Interrupt Cause Read Register
+#define ICR_OFFSET      0xC0
+
+// 13.4.20 Interrupt Mask Set/Read Register
+#define IMS_OFFSET      0xD0
+
+// Table 13-67. Interrupt Cause Read Register Bit Description
+#define ICR_RXT0        (1 << 7)    // Receiver Timer Interrupt
+
 // 13.4.22 Receive Control Register
 #define RCTL_EN             (1 << 1)
 #define RCTL_LPE            (1 << 5)
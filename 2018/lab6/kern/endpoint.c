@@ -0,0 +1,133 @@
+// IPC endpoint table.  See kern/endpoint.h for the model; the system
+// calls themselves live in kern/syscall.c.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/env.h>
+#include <kern/endpoint.h>
+
+static struct Endpoint endpoints[NEP];
+
+// Allocate an endpoint owned by 'owner' and record it as the endpoint
+// the owner serves.
+// Returns the new endpoint id, or -E_NO_FREE_ENV if the table is full.
+int
+ep_alloc(struct Env *owner, struct Endpoint **ep_store)
+{
+	struct Endpoint *ep;
+	int32_t generation;
+
+	for (ep = endpoints; ep < endpoints + NEP; ep++)
+		if (ep->ep_owner == 0)
+			break;
+	if (ep == endpoints + NEP)
+		return -E_NO_FREE_ENV;
+
+	// Same scheme as env_alloc: keep ids positive and distinct
+	// from those of earlier endpoints in this slot.
+	generation = (ep->ep_id + (1 << LOG2NEP)) & ~(NEP - 1);
+	if (generation <= 0)
+		generation = 1 << LOG2NEP;
+
+	ep->ep_id = generation | (ep - endpoints);
+	ep->ep_owner = owner->env_id;
+	ep->ep_recving = 0;
+	ep->ep_head = ep->ep_tail = NULL;
+	owner->env_ep = ep->ep_id;
+
+	*ep_store = ep;
+	return ep->ep_id;
+}
+
+// Translate an endpoint id into its struct Endpoint.
+// Returns 0 on success, -E_BAD_ENV if there is no such endpoint.
+int
+ep_lookup(int32_t epid, struct Endpoint **ep_store)
+{
+	struct Endpoint *ep;
+
+	if (epid <= 0)
+		return -E_BAD_ENV;
+	ep = &endpoints[EPX(epid)];
+	if (ep->ep_owner == 0 || ep->ep_id != epid)
+		return -E_BAD_ENV;
+	*ep_store = ep;
+	return 0;
+}
+
+// Queue 'caller' behind the callers already waiting on 'ep'.
+void
+ep_enqueue(struct Endpoint *ep, struct Env *caller)
+{
+	caller->env_ep_link = NULL;
+	if (ep->ep_tail)
+		ep->ep_tail->env_ep_link = caller;
+	else
+		ep->ep_head = caller;
+	ep->ep_tail = caller;
+}
+
+// Remove and return the oldest caller waiting on 'ep', or NULL.
+struct Env *
+ep_dequeue(struct Endpoint *ep)
+{
+	struct Env *caller = ep->ep_head;
+
+	if (caller) {
+		ep->ep_head = caller->env_ep_link;
+		if (!ep->ep_head)
+			ep->ep_tail = NULL;
+		caller->env_ep_link = NULL;
+	}
+	return caller;
+}
+
+// Remove 'caller' from the queue of 'ep', wherever it is.
+static void
+ep_unlink(struct Endpoint *ep, struct Env *caller)
+{
+	struct Env **pp, *prev = NULL;
+
+	for (pp = &ep->ep_head; *pp; prev = *pp, pp = &(*pp)->env_ep_link)
+		if (*pp == caller) {
+			*pp = caller->env_ep_link;
+			if (ep->ep_tail == caller)
+				ep->ep_tail = prev;
+			caller->env_ep_link = NULL;
+			return;
+		}
+}
+
+// Called from env_free.  Drops e from any endpoint queue it's on, and if
+// e owned an endpoint, frees it and fails every call still pending on it
+// with -E_BAD_ENV.
+void
+ep_env_free(struct Env *e)
+{
+	struct Endpoint *ep;
+	struct Env *c;
+
+	if (e->env_ep_calling && !e->env_ep_accepted &&
+	    ep_lookup(e->env_ep_calling, &ep) == 0)
+		ep_unlink(ep, e);
+	e->env_ep_calling = 0;
+
+	if (e->env_ep && ep_lookup(e->env_ep, &ep) == 0) {
+		for (c = envs; c < envs + NENV; c++) {
+			if (c->env_ep_calling != ep->ep_id)
+				continue;
+			c->env_ep_calling = 0;
+			c->env_ep_accepted = 0;
+			c->env_ep_link = NULL;
+			if (c->env_status == ENV_NOT_RUNNABLE) {
+				c->env_tf.tf_regs.reg_eax = -E_BAD_ENV;
+				c->env_status = ENV_RUNNABLE;
+			}
+		}
+		// ep_id is kept as the generation seed for ep_alloc.
+		ep->ep_owner = 0;
+		ep->ep_head = ep->ep_tail = NULL;
+	}
+	e->env_ep = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef JOS_KERN_ENDPOINT_H
+#define JOS_KERN_ENDPOINT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+// An endpoint is a rendezvous point owned by a server environment.
+// Clients block in sys_ep_call() until the owner receives their call
+// with sys_ep_recv() and later answers it with sys_ep_reply().  Calls
+// that arrive while the owner is busy queue up on the endpoint, so the
+// owner can hold several received-but-unanswered calls at once.
+//
+// An endpoint id looks like an envid: the low LOG2NEP bits index
+// 'endpoints[]' and the rest is a generation count, so ids of freed
+// endpoints are not accidentally reused.
+
+#define LOG2NEP		6
+#define NEP		(1 << LOG2NEP)
+#define EPX(epid)	((epid) & (NEP - 1))
+
+struct Endpoint {
+	int32_t ep_id;			// Current (or last) id of this slot
+	envid_t ep_owner;		// Env that receives and replies, 0 if free
+	bool ep_recving;		// Owner is blocked in sys_ep_recv
+	void *ep_dstva;			// Where the owner wants the call page
+	struct Env *ep_head;		// Queue of callers not yet received
+	struct Env *ep_tail;
+};
+
+int ep_alloc(struct Env *owner, struct Endpoint **ep_store);
+int ep_lookup(int32_t epid, struct Endpoint **ep_store);
+void ep_enqueue(struct Endpoint *ep, struct Env *caller);
+struct Env *ep_dequeue(struct Endpoint *ep);
+void ep_env_free(struct Env *e);
+
+#endif	// !JOS_KERN_ENDPOINT_H
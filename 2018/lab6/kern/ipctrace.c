@@ -0,0 +1,254 @@
+// IPC tracing.
+//
+// Every delivery (sys_ipc_try_send*, endpoint calls and replies), every
+// env blocking to receive, and every receiver's first run after a
+// delivery is appended to a ring of trace records.  On top of that,
+// per sender/receiver pair statistics are kept:
+//
+//   wake latency   from delivery until the receiver runs again, i.e.
+//                  time spent runnable waiting for a CPU;
+//   reply latency  from a delivery A->B until the next delivery B->A,
+//                  i.e. how long B took to answer A's request.
+//
+// Latencies are in TSC cycles, kept in power-of-two histograms.
+// The 'ipcstat' monitor command prints all of it.
+//
+// All hooks are called with the big kernel lock held.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/ipctrace.h>
+#include <kern/monitor.h>
+
+#define NTRACEREC	1024		// must be a power of 2
+#define NIPCPAIR	64		// must be a power of 2
+#define NLATBUCKET	32		// bucket i holds latencies in [2^i, 2^(i+1))
+
+struct LatHist {
+	uint32_t lh_count;
+	uint32_t lh_max;
+	uint32_t lh_bucket[NLATBUCKET];
+};
+
+struct IpcPair {
+	envid_t ip_from;		// 0 if the slot is free
+	envid_t ip_to;
+	uint32_t ip_msgs;
+	uint32_t ip_pages;
+	uint64_t ip_lastsend;		// tsc of the last undelivered reply, 0 if none
+	struct LatHist ip_wake;
+	struct LatHist ip_reply;
+};
+
+bool ipctrace_enabled = 1;
+
+static struct IpcTraceRec trace[NTRACEREC];
+static uint32_t trace_next;		// total records ever written
+
+static struct IpcPair pairs[NIPCPAIR];
+static uint32_t pairs_dropped;		// deliveries not counted, table full
+
+// Per receiver (indexed by ENVX): a delivery whose wake-up we're waiting
+// to see, with the pair it belongs to.
+static uint64_t wake_tsc[NENV];
+static struct IpcPair *wake_pair[NENV];
+
+static void
+trace_add(uint64_t tsc, int type, envid_t from, envid_t to, uint32_t value, size_t npages)
+{
+	struct IpcTraceRec *r = &trace[trace_next++ & (NTRACEREC - 1)];
+
+	r->it_tsc = tsc;
+	r->it_type = type;
+	r->it_npages = npages;
+	r->it_from = from;
+	r->it_to = to;
+	r->it_value = value;
+}
+
+static void
+lat_add(struct LatHist *h, uint64_t delta)
+{
+	uint32_t d = (delta > 0xffffffff) ? 0xffffffff : delta;
+	int b = 0;
+
+	while (b < NLATBUCKET - 1 && (d >> (b + 1)))
+		b++;
+	h->lh_count++;
+	h->lh_bucket[b]++;
+	if (d > h->lh_max)
+		h->lh_max = d;
+}
+
+// Return an upper bound on the pct'th percentile of h.
+static uint32_t
+lat_percentile(struct LatHist *h, int pct)
+{
+	uint32_t want = (h->lh_count * pct + 99) / 100, seen = 0;
+	int b;
+
+	for (b = 0; b < NLATBUCKET; b++) {
+		seen += h->lh_bucket[b];
+		if (seen >= want)
+			return (b == NLATBUCKET - 1) ? h->lh_max : MIN((2u << b) - 1, h->lh_max);
+	}
+	return h->lh_max;
+}
+
+// Find (or, if 'create', add) the statistics for messages from -> to.
+static struct IpcPair *
+pair_lookup(envid_t from, envid_t to, bool create)
+{
+	uint32_t h = (ENVX(from) * 31 + ENVX(to)) & (NIPCPAIR - 1);
+	int i;
+
+	for (i = 0; i < NIPCPAIR; i++) {
+		struct IpcPair *p = &pairs[(h + i) & (NIPCPAIR - 1)];
+		if (p->ip_from == from && p->ip_to == to)
+			return p;
+		if (p->ip_from == 0) {
+			if (!create)
+				return NULL;
+			memset(p, 0, sizeof(*p));
+			p->ip_from = from;
+			p->ip_to = to;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// 'from' just delivered 'value' (and 'npages' pages) to 'to', which will
+// return from its receive call the next time it runs.
+void
+ipctrace_send(struct Env *from, struct Env *to, uint32_t value, size_t npages)
+{
+	struct IpcPair *p, *req;
+	uint64_t now;
+
+	if (!ipctrace_enabled)
+		return;
+	now = read_tsc();
+	trace_add(now, IPCT_SEND, from->env_id, to->env_id, value, npages);
+
+	// Is this the answer to an earlier to -> from message?
+	if ((req = pair_lookup(to->env_id, from->env_id, 0)) && req->ip_lastsend) {
+		lat_add(&req->ip_reply, now - req->ip_lastsend);
+		req->ip_lastsend = 0;
+	}
+
+	if (!(p = pair_lookup(from->env_id, to->env_id, 1))) {
+		pairs_dropped++;
+		return;
+	}
+	p->ip_msgs++;
+	p->ip_pages += npages;
+	p->ip_lastsend = now;
+
+	wake_tsc[ENVX(to->env_id)] = now;
+	wake_pair[ENVX(to->env_id)] = p;
+}
+
+// 'e' is about to block waiting for a message.
+void
+ipctrace_recv(struct Env *e)
+{
+	if (!ipctrace_enabled)
+		return;
+	trace_add(read_tsc(), IPCT_RECV, 0, e->env_id, 0, 0);
+}
+
+// Called from env_run: 'e' is about to run.  If it was woken up by a
+// delivery, account for how long it waited for the CPU.
+void
+ipctrace_wake(struct Env *e)
+{
+	uint64_t now, sent;
+	struct IpcPair *p;
+
+	if (!(sent = wake_tsc[ENVX(e->env_id)]))
+		return;
+	now = read_tsc();
+	p = wake_pair[ENVX(e->env_id)];
+	wake_tsc[ENVX(e->env_id)] = 0;
+
+	// The pair slot may have been reset, or reused, since the send.
+	if (!ipctrace_enabled || p->ip_to != e->env_id)
+		return;
+	lat_add(&p->ip_wake, now - sent);
+	trace_add(now, IPCT_WAKE, p->ip_from, e->env_id, 0, 0);
+}
+
+static void
+print_lat(const char *what, struct LatHist *h)
+{
+	if (h->lh_count == 0) {
+		cprintf("    %-5s  -\n", what);
+		return;
+	}
+	cprintf("    %-5s  n %u  p50 %u  p90 %u  p99 %u  max %u\n", what,
+		h->lh_count, lat_percentile(h, 50), lat_percentile(h, 90),
+		lat_percentile(h, 99), h->lh_max);
+}
+
+static void
+print_trace(int n)
+{
+	static const char * const types[] = { "send", "recv", "wake" };
+	uint32_t i, first;
+
+	if (n > NTRACEREC)
+		n = NTRACEREC;
+	first = (trace_next > n) ? trace_next - n : 0;
+	for (i = first; i < trace_next; i++) {
+		struct IpcTraceRec *r = &trace[i & (NTRACEREC - 1)];
+		cprintf("%016llx %s %08x -> %08x", r->it_tsc, types[r->it_type],
+			r->it_from, r->it_to);
+		if (r->it_type == IPCT_SEND)
+			cprintf(" value %08x pages %d", r->it_value, r->it_npages);
+		cprintf("\n");
+	}
+}
+
+int
+mon_ipcstat(int argc, char **argv, struct Trapframe *tf)
+{
+	int i;
+
+	if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+		memset(pairs, 0, sizeof(pairs));
+		memset(wake_tsc, 0, sizeof(wake_tsc));
+		pairs_dropped = 0;
+		trace_next = 0;
+		return 0;
+	}
+	if (argc >= 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+		ipctrace_enabled = (strcmp(argv[1], "on") == 0);
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "trace") == 0) {
+		print_trace((argc >= 3) ? strtol(argv[2], NULL, 0) : 32);
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: ipcstat [trace [N] | reset | on | off]\n");
+		return 0;
+	}
+
+	cprintf("IPC pairs (latencies in cycles):\n");
+	for (i = 0; i < NIPCPAIR; i++) {
+		struct IpcPair *p = &pairs[i];
+		if (p->ip_from == 0)
+			continue;
+		cprintf("  %08x -> %08x  msgs %u  pages %u\n",
+			p->ip_from, p->ip_to, p->ip_msgs, p->ip_pages);
+		print_lat("wake", &p->ip_wake);
+		print_lat("reply", &p->ip_reply);
+	}
+	if (pairs_dropped)
+		cprintf("  (%u messages not counted, pair table full)\n", pairs_dropped);
+	return 0;
+}
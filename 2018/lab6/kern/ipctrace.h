@@ -0,0 +1,29 @@
+#ifndef JOS_KERN_IPCTRACE_H
+#define JOS_KERN_IPCTRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+// Kinds of IPC trace records
+enum {
+	IPCT_SEND = 0,	// a message was delivered to a blocked receiver
+	IPCT_RECV,	// an env blocked waiting for a message
+	IPCT_WAKE,	// a receiver started running after delivery
+};
+
+struct IpcTraceRec {
+	uint64_t it_tsc;	// read_tsc() when the event happened
+	uint8_t it_type;	// IPCT_*
+	uint8_t it_npages;	// pages mapped by a send, 0 if none
+	envid_t it_from;
+	envid_t it_to;
+	uint32_t it_value;
+};
+
+void ipctrace_send(struct Env *from, struct Env *to, uint32_t value, size_t npages);
+void ipctrace_recv(struct Env *e);
+void ipctrace_wake(struct Env *e);
+
+#endif	// !JOS_KERN_IPCTRACE_H
@@ -0,0 +1,161 @@
+// Kernel event tracing.
+//
+// Tracepoints (the TRACE() macro) append fixed-size binary records to
+// a ring per CPU.  A CPU only ever writes its own ring, so recording
+// an event takes no lock and costs a rdtsc and a few stores; the rings
+// simply overwrite their oldest records.  Event types can be turned on
+// and off individually with ktrace_mask, which is all on by default.
+//
+// The 'ktrace' monitor command merges the rings by timestamp and dumps
+// the most recent events, optionally only of one type or one env, to
+// reconstruct what the CPUs were doing.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/ktrace.h>
+#include <kern/monitor.h>
+
+#define NKTRACEREC	512		// per CPU, must be a power of 2
+
+struct KtraceRing {
+	uint32_t kr_next;		// total records ever written
+	struct KtraceRec kr_recs[NKTRACEREC];
+};
+
+uint32_t ktrace_mask = (1 << NKTRACE) - 1;
+
+static struct KtraceRing rings[NCPU];
+
+static const char * const names[NKTRACE] = {
+	[KT_ENV_RUN]	= "env_run",
+	[KT_SCHED]	= "sched",
+	[KT_TRAP]	= "trap",
+	[KT_SYSCALL]	= "syscall",
+	[KT_SYSRET]	= "sysret",
+	[KT_PAGE_ALLOC]	= "page_alloc",
+	[KT_PAGE_FREE]	= "page_free",
+	[KT_TX_PKT]	= "tx_pkt",
+	[KT_RX_PKT]	= "rx_pkt",
+	[KT_USER]	= "user",
+};
+
+void
+ktrace_add(int type, uint32_t a0, uint32_t a1)
+{
+	int cpu = cpunum();
+	struct KtraceRing *r = &rings[cpu];
+	struct KtraceRec *rec = &r->kr_recs[r->kr_next++ & (NKTRACEREC - 1)];
+
+	rec->kt_tsc = read_tsc();
+	rec->kt_type = type;
+	rec->kt_cpu = cpu;
+	rec->kt_env = curenv ? curenv->env_id : 0;
+	rec->kt_a0 = a0;
+	rec->kt_a1 = a1;
+}
+
+static int
+type_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NKTRACE; i++)
+		if (strcmp(names[i], name) == 0)
+			return i;
+	return -1;
+}
+
+static bool
+rec_match(struct KtraceRec *rec, int type, envid_t env)
+{
+	return (type < 0 || rec->kt_type == type) && (!env || rec->kt_env == env);
+}
+
+// Print the last 'n' records matching 'type' (all if -1) and 'env'
+// (all if 0), oldest first, merging the per-CPU rings by timestamp.
+static void
+dump(int n, int type, envid_t env)
+{
+	uint32_t pos[NCPU];
+	struct KtraceRec *rec, *best;
+	int cpu, bestcpu, total = 0, skip;
+
+	for (cpu = 0; cpu < NCPU; cpu++) {
+		uint32_t next = rings[cpu].kr_next;
+		pos[cpu] = (next > NKTRACEREC) ? next - NKTRACEREC : 0;
+		for (uint32_t i = pos[cpu]; i < next; i++)
+			if (rec_match(&rings[cpu].kr_recs[i & (NKTRACEREC - 1)], type, env))
+				total++;
+	}
+	skip = (total > n) ? total - n : 0;
+
+	for (;;) {
+		best = NULL;
+		bestcpu = 0;
+		for (cpu = 0; cpu < NCPU; cpu++) {
+			if (pos[cpu] == rings[cpu].kr_next)
+				continue;
+			rec = &rings[cpu].kr_recs[pos[cpu] & (NKTRACEREC - 1)];
+			if (!best || rec->kt_tsc < best->kt_tsc) {
+				best = rec;
+				bestcpu = cpu;
+			}
+		}
+		if (!best)
+			break;
+		pos[bestcpu]++;
+		if (!rec_match(best, type, env) || skip-- > 0)
+			continue;
+		cprintf("%016llx cpu %d env %08x %-10s %08x %08x\n",
+			best->kt_tsc, best->kt_cpu, best->kt_env,
+			names[best->kt_type], best->kt_a0, best->kt_a1);
+	}
+}
+
+int
+mon_ktrace(int argc, char **argv, struct Trapframe *tf)
+{
+	int i, type = -1;
+
+	if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+		memset(rings, 0, sizeof(rings));
+		return 0;
+	}
+	if (argc >= 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+		bool on = (strcmp(argv[1], "on") == 0);
+		uint32_t bits = (1 << NKTRACE) - 1;
+
+		if (argc >= 3 && (type = type_lookup(argv[2])) < 0) {
+			cprintf("ktrace: unknown event type '%s'\n", argv[2]);
+			return 0;
+		}
+		if (type >= 0)
+			bits = 1 << type;
+		ktrace_mask = on ? (ktrace_mask | bits) : (ktrace_mask & ~bits);
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "dump") == 0) {
+		if (argc >= 4 && strcmp(argv[3], "all") != 0 &&
+		    (type = type_lookup(argv[3])) < 0) {
+			cprintf("ktrace: unknown event type '%s'\n", argv[3]);
+			return 0;
+		}
+		dump((argc >= 3) ? strtol(argv[2], NULL, 0) : 32, type,
+		     (argc >= 5) ? strtol(argv[4], NULL, 16) : 0);
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: ktrace [dump [N [TYPE|all [ENVID]]] | reset | on [TYPE] | off [TYPE]]\n");
+		return 0;
+	}
+
+	cprintf("Event types (* = enabled):");
+	for (i = 0; i < NKTRACE; i++)
+		cprintf(" %s%s", names[i], (ktrace_mask & (1 << i)) ? "*" : "");
+	cprintf("\n");
+	return 0;
+}
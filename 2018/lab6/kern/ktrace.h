@@ -0,0 +1,30 @@
+#ifndef JOS_KERN_KTRACE_H
+#define JOS_KERN_KTRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/ktrace.h>
+
+struct KtraceRec {
+	uint64_t kt_tsc;	// read_tsc() when the event happened
+	uint16_t kt_type;	// KT_*
+	uint16_t kt_cpu;
+	int32_t kt_env;		// env running on the CPU, 0 if none
+	uint32_t kt_a0;
+	uint32_t kt_a1;
+};
+
+extern uint32_t ktrace_mask;	// bit (1 << KT_*) set if enabled
+
+void ktrace_add(int type, uint32_t a0, uint32_t a1);
+
+// Record an event of type 'type' if that type is enabled.
+#define TRACE(type, a0, a1)						\
+	do {								\
+		if (ktrace_mask & (1 << (type)))			\
+			ktrace_add((type), (uint32_t) (a0), (uint32_t) (a1)); \
+	} while (0)
+
+#endif	// !JOS_KERN_KTRACE_H
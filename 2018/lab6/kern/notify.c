@@ -0,0 +1,90 @@
+// Per-environment notification words.
+//
+// Each environment has a 32-bit word of pending notification bits.
+// Device interrupts, timer expiry (kern/timer.c) and other environments set bits in it
+// with notify_post(); sys_notify_wait() blocks until one of the bits the
+// environment is interested in is set, then consumes those bits.
+// Bits posted while nobody is waiting stay pending, so an event that
+// arrives between polling a device and calling sys_notify_wait() is
+// not lost.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/env.h>
+#include <kern/notify.h>
+#include <kern/picirq.h>
+#include <kern/timer.h>
+
+// Device notification sources and the environment each one is
+// delivered to.  A stale envid is harmless: envid2env() rejects it.
+static struct {
+	uint32_t bit;
+	envid_t envid;
+} sources[] = {
+	{ NOTIFY_NET, 0 },
+	{ NOTIFY_DISK, 0 },
+};
+
+// Make a waiting env runnable again, with sys_notify_wait() returning
+// the bits that woke it up.
+static void
+notify_wake(struct Env *e)
+{
+	uint32_t bits = e->env_notify_pending & e->env_notify_mask;
+
+	e->env_notify_pending &= ~bits;
+	e->env_notify_mask = 0;
+	timer_cancel(e);
+	e->env_tf.tf_regs.reg_eax = bits;
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Set 'bits' in e's notification word, waking e up if it is blocked
+// in sys_notify_wait() on any of them.
+void
+notify_post(struct Env *e, uint32_t bits)
+{
+	e->env_notify_pending |= bits;
+	if (e->env_status == ENV_NOT_RUNNABLE &&
+	    (e->env_notify_mask & e->env_notify_pending))
+		notify_wake(e);
+}
+
+// Called from interrupt handlers: post device bit 'bit' to whichever
+// environment is bound to it, if any.
+void
+notify_irq(uint32_t bit)
+{
+	struct Env *e;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++)
+		if (sources[i].bit == bit && sources[i].envid &&
+		    envid2env(sources[i].envid, &e, 0) == 0)
+			notify_post(e, bit);
+}
+
+// Deliver the device notifications in 'bits' to 'e' from now on.
+// Returns 0 on success, -E_INVAL if 'bits' contains a non-device bit.
+int
+notify_bind(struct Env *e, uint32_t bits)
+{
+	uint32_t known = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++)
+		known |= sources[i].bit;
+	if (bits == 0 || (bits & ~known))
+		return -E_INVAL;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++)
+		if (bits & sources[i].bit)
+			sources[i].envid = e->env_id;
+
+	// The IDE interrupt stays masked until someone wants it, since the
+	// file system server polls the disk and doesn't care otherwise.
+	if (bits & NOTIFY_DISK)
+		irq_setmask_8259A(irq_mask_8259A & ~(1 << IRQ_IDE));
+	return 0;
+}
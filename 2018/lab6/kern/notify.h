@@ -0,0 +1,13 @@
+#ifndef JOS_KERN_NOTIFY_H
+#define JOS_KERN_NOTIFY_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void notify_post(struct Env *e, uint32_t bits);
+void notify_irq(uint32_t bit);
+int notify_bind(struct Env *e, uint32_t bits);
+
+#endif	// !JOS_KERN_NOTIFY_H
@@ -4,6 +4,7 @@
 #include <kern/pci.h>
 #include <kern/pcireg.h>
 #include <kern/e1000.h>
+#include <kern/piix.h>
 
 // Flag to do "lspci" at bootup
 static int pci_show_devs = 1;
@@ -32,6 +33,7 @@ struct pci_driver pci_attach_class[] = {
 // and key2 should be the vendor ID and device ID respectively
 struct pci_driver pci_attach_vendor[] = {
 	{ PCI_E1000_VENDOR_ID, PCI_E1000_DEVICE_ID, &e1000_attach },
+	{ PCI_PIIX_IDE_VENDOR_ID, PCI_PIIX_IDE_DEVICE_ID, &piix_attach },
 	{ 0, 0, 0 },
 };
 
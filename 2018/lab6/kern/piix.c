@@ -0,0 +1,21 @@
+// PIIX IDE controller.
+//
+// The disks are driven by the file system environment, which has I/O
+// privilege.  All the kernel does is turn on bus mastering and remember
+// where the bus-master DMA registers (BAR4) are, so that the file
+// system can find them with sys_ide_bmbase().
+
+#include <inc/stdio.h>
+
+#include <kern/piix.h>
+
+uint32_t piix_bmbase;	// I/O port base of the bus-master registers, 0 if none
+
+int
+piix_attach(struct pci_func *pcif)
+{
+	pci_func_enable(pcif);
+	piix_bmbase = pcif->reg_base[4];
+	cprintf("PIIX IDE: bus-master registers at port 0x%x\n", piix_bmbase);
+	return 0;
+}
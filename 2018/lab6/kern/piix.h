@@ -0,0 +1,16 @@
+#ifndef JOS_KERN_PIIX_H
+#define JOS_KERN_PIIX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/pci.h>
+
+#define PCI_PIIX_IDE_VENDOR_ID	0x8086
+#define PCI_PIIX_IDE_DEVICE_ID	0x7010	// PIIX3 IDE, what QEMU emulates
+
+int piix_attach(struct pci_func *pcif);
+
+extern uint32_t piix_bmbase;
+
+#endif	// !JOS_KERN_PIIX_H
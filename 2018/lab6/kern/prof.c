@@ -0,0 +1,294 @@
+// Sampling profiler.
+//
+// While profiling is on, every scheduler tick records the interrupted
+// eip, CPU and environment in a per-CPU ring of samples.  The 'prof'
+// monitor command turns kernel samples into a hot-function report,
+// symbolized with debuginfo_eip(); user samples are read out with
+// sys_prof_read() and reported by user/profdump.
+//
+// Each tick also records the interrupted call stack, found by walking
+// the ebp chain as mon_backtrace does.  User frames are read with
+// copyin(), so a bogus user ebp just ends the walk.  'prof stacks'
+// prints them in the folded format flame graph tools take, one
+// "root;caller;...;leaf count" line per distinct stack.
+//
+// The kernel runs with interrupts off except while halted in
+// sched_halt(), so kernel samples only show how much time CPUs spend
+// idle.  They will say more once the kernel can take interrupts.
+
+#include <inc/assert.h>
+#include <inc/string.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/kdebug.h>
+#include <kern/monitor.h>
+#include <kern/prof.h>
+#include <kern/usercopy.h>
+
+#define NPROFSAMPLE	2048		// per CPU, must be a power of 2
+#define NPROFSTACK	256		// per CPU, must be a power of 2
+#define PROF_MAXDEPTH	16		// frames kept per stack
+#define NPROFFN		64		// functions in a report
+#define NPROFTOP	20		// functions printed
+#define NPROFFOLD	128		// distinct stacks in a folded report
+
+struct ProfRing {
+	uint32_t pr_next;		// total samples ever taken
+	struct ProfSample pr_samples[NPROFSAMPLE];
+};
+
+struct ProfStack {
+	envid_t pk_env;			// as in struct ProfSample
+	uint16_t pk_user;
+	uint16_t pk_depth;		// entries used in pk_pcs
+	uintptr_t pk_pcs[PROF_MAXDEPTH];	// leaf first
+};
+
+struct ProfStackRing {
+	uint32_t pk_next;		// total stacks ever taken
+	struct ProfStack pk_stacks[NPROFSTACK];
+};
+
+bool prof_enabled;
+
+static struct ProfRing rings[NCPU];
+static struct ProfStackRing stack_rings[NCPU];
+
+// Walk the ebp chain of the context 'tf' interrupted, filling in 'pk'.
+// Kernel frames must stay on the kernel stack this CPU is running on,
+// the KSTKSIZE bytes below ts_esp0 (trap_init_percpu points it, and
+// SYSENTER_ESP, into percpu_kstacks rather than at the KSTACKTOP
+// mapping); user frames are read from the current address space with
+// copyin().
+static void
+prof_stack(struct Trapframe *tf, struct ProfStack *pk)
+{
+	uintptr_t stacktop = thiscpu->cpu_ts.ts_esp0;
+	uint32_t frame[2], ebp = tf->tf_regs.reg_ebp;	// saved ebp, return eip
+
+	pk->pk_depth = 0;
+	pk->pk_pcs[pk->pk_depth++] = tf->tf_eip;
+	while (ebp && pk->pk_depth < PROF_MAXDEPTH) {
+		if (pk->pk_user) {
+			if (copyin(frame, (void *) ebp, sizeof(frame)) < 0)
+				break;
+		} else {
+			if (ebp < stacktop - KSTKSIZE || ebp > stacktop - sizeof(frame))
+				break;
+			memmove(frame, (void *) ebp, sizeof(frame));
+		}
+		pk->pk_pcs[pk->pk_depth++] = frame[1];
+		// Frames move up the stack; anything else is garbage.
+		if (frame[0] <= ebp)
+			break;
+		ebp = frame[0];
+	}
+}
+
+// Called from the timer interrupt on every scheduler tick.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfRing *r;
+	struct ProfSample *s;
+
+	if (!prof_enabled)
+		return;
+	r = &rings[cpunum()];
+	s = &r->pr_samples[r->pr_next++ & (NPROFSAMPLE - 1)];
+	s->ps_eip = tf->tf_eip;
+	s->ps_env = curenv ? curenv->env_id : 0;
+	s->ps_cpu = cpunum();
+	s->ps_user = (tf->tf_cs & 3) == 3;
+
+	struct ProfStackRing *sr = &stack_rings[cpunum()];
+	struct ProfStack *pk = &sr->pk_stacks[sr->pk_next++ & (NPROFSTACK - 1)];
+	pk->pk_env = s->ps_env;
+	pk->pk_user = s->ps_user;
+	prof_stack(tf, pk);
+}
+
+// Copy up to 'n' of the user samples still in the rings into
+// 'usamples', only those of environment 'envid' unless it is 0.
+// Returns the number of samples copied, or -E_FAULT.
+int
+prof_read(envid_t envid, struct ProfSample *usamples, size_t n)
+{
+	struct ProfRing *r;
+	uint32_t i;
+	int count = 0, err;
+
+	for (r = rings; r < rings + NCPU && count < n; r++) {
+		i = (r->pr_next > NPROFSAMPLE) ? r->pr_next - NPROFSAMPLE : 0;
+		for (; i < r->pr_next && count < n; i++) {
+			struct ProfSample *s = &r->pr_samples[i & (NPROFSAMPLE - 1)];
+
+			if (!s->ps_user || (envid && s->ps_env != envid))
+				continue;
+			if ((err = copyout(&usamples[count], s, sizeof(*s))) < 0)
+				return err;
+			count++;
+		}
+	}
+	return count;
+}
+
+struct ProfFn {
+	uintptr_t pf_addr;
+	const char *pf_name;
+	int pf_namelen;
+	uint32_t pf_count;
+};
+
+static void
+print_report(void)
+{
+	static struct ProfFn fns[NPROFFN];
+	struct Eipdebuginfo info;
+	struct ProfRing *r;
+	uint32_t i, nfn = 0, total = 0, user = 0, other = 0;
+	int j, k;
+
+	memset(fns, 0, sizeof(fns));
+	for (r = rings; r < rings + NCPU; r++) {
+		i = (r->pr_next > NPROFSAMPLE) ? r->pr_next - NPROFSAMPLE : 0;
+		for (; i < r->pr_next; i++) {
+			struct ProfSample *s = &r->pr_samples[i & (NPROFSAMPLE - 1)];
+
+			total++;
+			if (s->ps_user) {
+				user++;
+				continue;
+			}
+			if (debuginfo_eip(s->ps_eip, &info) < 0) {
+				other++;
+				continue;
+			}
+			for (j = 0; j < nfn; j++)
+				if (fns[j].pf_addr == info.eip_fn_addr)
+					break;
+			if (j == nfn) {
+				if (nfn == NPROFFN) {
+					other++;
+					continue;
+				}
+				fns[nfn].pf_addr = info.eip_fn_addr;
+				fns[nfn].pf_name = info.eip_fn_name;
+				fns[nfn].pf_namelen = info.eip_fn_namelen;
+				nfn++;
+			}
+			fns[j].pf_count++;
+		}
+	}
+
+	// Insertion sort, most samples first
+	for (j = 1; j < nfn; j++) {
+		struct ProfFn f = fns[j];
+		for (k = j; k > 0 && fns[k - 1].pf_count < f.pf_count; k--)
+			fns[k] = fns[k - 1];
+		fns[k] = f;
+	}
+
+	cprintf("%u samples, %u user (see profdump), %u kernel\n",
+		total, user, total - user);
+	for (j = 0; j < nfn && j < NPROFTOP; j++)
+		cprintf("  %6u %3u%%  %08x %.*s\n", fns[j].pf_count,
+			fns[j].pf_count * 100 / total, fns[j].pf_addr,
+			fns[j].pf_namelen, fns[j].pf_name);
+	if (other)
+		cprintf("  %6u       (unknown or not listed)\n", other);
+}
+
+// One folded frame: kernel functions by name, user ones by address.
+static void
+print_frame(struct ProfStack *pk, int i)
+{
+	struct Eipdebuginfo info;
+
+	if (!pk->pk_user && debuginfo_eip(pk->pk_pcs[i], &info) == 0)
+		cprintf(";%.*s", info.eip_fn_namelen, info.eip_fn_name);
+	else
+		cprintf(";0x%08x", pk->pk_pcs[i]);
+}
+
+static void
+print_folded(struct ProfStack *pk, uint32_t count)
+{
+	int i;
+
+	if (pk->pk_user)
+		cprintf("env_%08x", pk->pk_env);
+	else
+		cprintf("kernel");
+	for (i = pk->pk_depth - 1; i >= 0; i--)
+		print_frame(pk, i);
+	cprintf(" %u\n", count);
+}
+
+static bool
+same_stack(struct ProfStack *a, struct ProfStack *b)
+{
+	return a->pk_user == b->pk_user && a->pk_env == b->pk_env &&
+		a->pk_depth == b->pk_depth &&
+		memcmp(a->pk_pcs, b->pk_pcs, a->pk_depth * sizeof(uintptr_t)) == 0;
+}
+
+// Print every stack still in the rings, counting identical stacks
+// once with their number of samples.  Stacks that don't fit in the
+// table are printed as they come, with a count of 1; flame graph
+// tools add up repeated lines anyway.
+static void
+print_stacks(void)
+{
+	static struct ProfStack *uniq[NPROFFOLD];
+	static uint32_t counts[NPROFFOLD];
+	struct ProfStackRing *sr;
+	uint32_t i;
+	int j, nuniq = 0;
+
+	for (sr = stack_rings; sr < stack_rings + NCPU; sr++) {
+		i = (sr->pk_next > NPROFSTACK) ? sr->pk_next - NPROFSTACK : 0;
+		for (; i < sr->pk_next; i++) {
+			struct ProfStack *pk = &sr->pk_stacks[i & (NPROFSTACK - 1)];
+
+			for (j = 0; j < nuniq; j++)
+				if (same_stack(uniq[j], pk))
+					break;
+			if (j < nuniq)
+				counts[j]++;
+			else if (nuniq < NPROFFOLD) {
+				uniq[nuniq] = pk;
+				counts[nuniq++] = 1;
+			} else
+				print_folded(pk, 1);
+		}
+	}
+	for (j = 0; j < nuniq; j++)
+		print_folded(uniq[j], counts[j]);
+}
+
+int
+mon_prof(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+		memset(rings, 0, sizeof(rings));
+		memset(stack_rings, 0, sizeof(stack_rings));
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "stacks") == 0) {
+		print_stacks();
+		return 0;
+	}
+	if (argc >= 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+		prof_enabled = (strcmp(argv[1], "on") == 0);
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: prof [stacks | reset | on | off]\n");
+		return 0;
+	}
+	cprintf("Profiling is %s.\n", prof_enabled ? "on" : "off");
+	print_report();
+	return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/prof.h>
+#include <inc/trap.h>
+
+void prof_sample(struct Trapframe *tf);
+int prof_read(envid_t envid, struct ProfSample *usamples, size_t n);
+
+#endif	// !JOS_KERN_PROF_H
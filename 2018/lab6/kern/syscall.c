@@ -13,6 +13,16 @@
 #include <kern/sched.h>
 #include <kern/time.h>
 #include <kern/e1000.h>
+#include <kern/piix.h>
+#include <kern/notify.h>
+#include <kern/endpoint.h>
+#include <kern/ipctrace.h>
+#include <kern/usercopy.h>
+#include <kern/timer.h>
+#include <kern/prof.h>
+#include <kern/ktrace.h>
+#include <kern/cpu.h>
+#include <kern/monitor.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -24,12 +34,20 @@ sys_cputs(const char *s, size_t len)
 	// Destroy the environment if not.
 
 	// LAB 3: Your code here.
-	pte_t *pte;
-
-	user_mem_assert(curenv, (void *)s, len, 0);
+	char buf[256];
+	size_t n;
 
-	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+	// Print the string supplied by the user, a bufferful at a time.
+	for (; len > 0; s += n, len -= n) {
+		n = MIN(len, sizeof(buf));
+		if (copyin(buf, s, n) < 0) {
+			cprintf("[%08x] user_mem_check assertion failure for "
+				"va %08x\n", curenv->env_id, s);
+			env_destroy(curenv);	// may not return
+			return;
+		}
+		cprintf("%.*s", n, buf);
+	}
 }
 
 // Read a character from the system console without blocking.
@@ -133,6 +151,7 @@ sys_env_set_status(envid_t envid, int status)
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
+//	-E_FAULT if tf is not readable by the caller.
 static int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 {
@@ -140,13 +159,15 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	// Remember to check whether the user has supplied us with a good
 	// address!
 	struct Env *e;
+	struct Trapframe ktf;
 	int r;
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
-	user_mem_assert(curenv, (void *)tf, sizeof(struct Trapframe), 0);	// It's ok to be read-only.
+	if ((r = copyin(&ktf, tf, sizeof(struct Trapframe))) < 0)	// It's ok to be read-only.
+		return r;
 	
-	memmove(&e->env_tf, tf, sizeof(struct Trapframe));
+	e->env_tf = ktf;
 	e->env_tf.tf_cs |= 3;
 	e->env_tf.tf_eflags |= FL_IF;
 	e->env_tf.tf_eflags &= ~FL_IOPL_MASK;	// Can't do |= FL_IOPL_0...*sigh*
@@ -300,6 +321,110 @@ sys_page_unmap(envid_t envid, void *va)
 	return 0;
 }
 
+// Map the 'npages' pages starting at 'srcva' in env 'src' into env 'dst'
+// starting at 'dstva', all with permission 'perm'.
+// Either every page is mapped or none is: all source pages are checked,
+// and all page tables the receiver needs are created, before the first
+// page_insert(), so the second loop cannot fail halfway through.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if srcva is not page-aligned, or the range reaches UTOP.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if a page in the range is not mapped in src's address space.
+//	-E_INVAL if (perm & PTE_W), but a page in the range is read-only in
+//		src's address space.
+//	-E_NO_MEM if there's not enough memory for the receiver's page tables.
+static int
+ipc_map_pages(struct Env *src, void *srcva, struct Env *dst, void *dstva,
+	      size_t npages, unsigned perm)
+{
+	size_t i;
+	pte_t *pte;
+	struct PageInfo *pp;
+
+	if (((uintptr_t)srcva >= UTOP) || ((uintptr_t)srcva % PGSIZE != 0))
+		return -E_INVAL;
+	if (npages > (UTOP - (uintptr_t)srcva) / PGSIZE)
+		return -E_INVAL;
+	if (((perm & PTE_U) != PTE_U) || ((perm & ~PTE_SYSCALL) != 0))
+		return -E_INVAL;
+
+	for (i = 0; i < npages; i++) {
+		pp = page_lookup(src->env_pgdir, srcva + i * PGSIZE, &pte);
+		if (!pp)
+			return -E_INVAL;	// not mapped in the sender's address space
+		if ((perm & PTE_W) && ((*pte & PTE_W) == 0))
+			return -E_INVAL;	// must not grant write access to a read-only page
+		if (!pgdir_walk(dst->env_pgdir, dstva + i * PGSIZE, 1))
+			return -E_NO_MEM;
+	}
+
+	for (i = 0; i < npages; i++) {
+		pp = page_lookup(src->env_pgdir, srcva + i * PGSIZE, NULL);
+		if (page_insert(dst->env_pgdir, pp, dstva + i * PGSIZE, perm) < 0)
+			panic("ipc_map_pages: page_insert failed after pgdir_walk\n");
+	}
+	return 0;
+}
+
+// Try to send 'value' to the target env 'envid', together with up to
+// 'npages' pages starting at 'srcva'.  The receiver gets
+// MIN(npages, size of the window it declared in sys_ipc_recv) pages,
+// mapped contiguously from the start of its window.
+//
+// The target's ipc fields are updated as in sys_ipc_try_send, and in
+// addition env_ipc_npages is set to the number of pages transferred.
+//
+// If srcva is -1, or the receiver isn't asking for pages, no page mapping
+// is transferred, but no error occurs.
+//
+// Returns 0 on success, < 0 on error.
+// Errors are those of sys_ipc_try_send, plus:
+//	-E_INVAL if npages is 0 or larger than IPC_MAXPAGES.
+static int
+sys_ipc_try_send_range(envid_t envid, uint32_t value, void *srcva, size_t npages, unsigned perm)
+{
+	struct Env *e;
+	int r;
+
+	if (envid2env(envid, &e, 0) < 0)
+		return -E_BAD_ENV;
+
+	if ((npages == 0) || (npages > IPC_MAXPAGES))
+		return -E_INVAL;
+
+	if ((e->env_status != ENV_NOT_RUNNABLE) || (e->env_ipc_recving == 0)) {
+		// Let a receiver that's busy waiting on something else know
+		// that it should come back to ipc_recv.
+		notify_post(e, NOTIFY_IPC);
+		return -E_IPC_NOT_RECV;
+	}
+
+	// If both side want to share pages:
+	bool transferring_page = ((uintptr_t)srcva != -1) && ((uintptr_t)e->env_ipc_dstva != -1);
+	if (transferring_page) {
+		// you can't really call sys_page_map here.
+		// sys_page_map perform checks on envid2env(), which will only allow
+		// page sharing from parent to child.
+		// you can't really add one argument to sys_page_map since we only
+		// have 5 arguments for syscall...
+		npages = MIN(npages, e->env_ipc_dstpages);
+		if ((r = ipc_map_pages(curenv, srcva, e, e->env_ipc_dstva, npages, perm)) < 0)
+			return r;
+	}
+
+	e->env_ipc_recving = 0;
+	e->env_ipc_from = curenv->env_id;
+	e->env_ipc_value = value;
+	e->env_ipc_perm = (transferring_page) ? perm : 0;
+	e->env_ipc_npages = (transferring_page) ? npages : 0;
+	ipctrace_send(curenv, e, value, e->env_ipc_npages);
+
+	timer_cancel(e);
+	e->env_status = ENV_RUNNABLE;
+	return 0;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -342,70 +467,47 @@ static int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
 	// LAB 4: Your code here.
-	
-	struct Env *e;
-	if (envid2env(envid, &e, 0) < 0) {
-		cprintf("debug: aha, bad envid: %x\n", envid);
-		return -E_BAD_ENV;
-	}
-
-	if ((e->env_status != ENV_NOT_RUNNABLE) || (e->env_ipc_recving == 0))
-		return -E_IPC_NOT_RECV;
-	
-	// If both side want to share a page:
-	bool transferring_page = ((uintptr_t)srcva != -1) && ((uintptr_t)e->env_ipc_dstva != -1);
-	if (transferring_page) {
-		// you can't really call sys_page_map here.
-		// sys_page_map perform checks on envid2env(), which will only allow
-		// page sharing from parent to child.
-		// you can't really add one argument to sys_page_map since we only
-		// have 5 arguments for syscall...
-		if (((uintptr_t)srcva >= UTOP) || ((uintptr_t)srcva % PGSIZE != 0))
-			return -E_INVAL;
-		if (((perm & PTE_U) != PTE_U) || ((perm & ~PTE_SYSCALL) != 0))
-			return -E_INVAL;
-		
-		pte_t *pte;
-		struct PageInfo *pp = page_lookup(curenv->env_pgdir, srcva, &pte);
-		if (!pp)	
-			return -E_INVAL;	// srcva is not mapped in srcenvid's address space
-		if ((perm & PTE_W) && ((*pte & PTE_W) == 0))
-			return -E_INVAL;	// must not grant write access to a read-only page
-		if (page_insert(e->env_pgdir, pp, e->env_ipc_dstva, perm) < 0)
-			return -E_NO_MEM;
-	}
-
-	e->env_ipc_recving = 0;
-	e->env_ipc_from = curenv->env_id;
-	e->env_ipc_value = value;
-	e->env_ipc_perm = (transferring_page) ? perm : 0;
-	
-	e->env_status = ENV_RUNNABLE;
-	return 0;
+	return sys_ipc_try_send_range(envid, value, srcva, 1, perm);
 }
 
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
-// If 'dstva' is < UTOP, then you are willing to receive a page of data.
-// 'dstva' is the virtual address at which the sent page should be mapped.
+// If 'dstva' is < UTOP, then you are willing to receive up to 'npages'
+// pages of data.  [dstva, dstva + npages * PGSIZE) is the window at which
+// the sent pages should be mapped.
+//
+// If 'deadline' is nonzero, give up once time_usec() reaches it.
 //
 // This function only returns on error, but the system call will eventually
-// return 0 on success.
+// return 0 on success, or -E_TIMEOUT if the deadline passed first.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but npages is 0, larger than IPC_MAXPAGES,
+//		or the window reaches UTOP.
+//	-E_TIMEOUT if the deadline has already passed.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, size_t npages, uint64_t deadline)
 {
 	// LAB 4: Your code here.
 	if (dstva != (void *)-1) {
 		if (((uintptr_t)dstva >= UTOP) || ((uintptr_t)dstva % PGSIZE != 0))
 			return -E_INVAL;
+		if ((npages == 0) || (npages > IPC_MAXPAGES))
+			return -E_INVAL;
+		if (npages > (UTOP - (uintptr_t)dstva) / PGSIZE)
+			return -E_INVAL;
 	}
+	if (deadline && deadline <= time_usec())
+		return -E_TIMEOUT;
 
 	curenv->env_ipc_recving = 1;
 	curenv->env_ipc_dstva = dstva;	// -1 means not receiving a page
+	curenv->env_ipc_dstpages = npages;
+	ipctrace_recv(curenv);
+	if (deadline)
+		timer_arm(curenv, deadline);
 
 	curenv->env_status = ENV_NOT_RUNNABLE;
 	
@@ -418,6 +520,276 @@ sys_ipc_recv(void *dstva)
 	return 0;
 }
 
+// Create an endpoint served by the current environment and record it in
+// curenv->env_ep, where clients can find it through 'envs[]'.
+// An environment serves at most one endpoint; calling this again returns
+// the existing one.
+//
+// Returns the endpoint id (> 0), or < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if the endpoint table is full.
+static int32_t
+sys_ep_create(void)
+{
+	struct Endpoint *ep;
+
+	if (curenv->env_ep)
+		return curenv->env_ep;
+	return ep_alloc(curenv, &ep);
+}
+
+// Hand the call 'caller' is blocked in over to 'owner', mapping the
+// call's page (if any) at 'dstva' in the owner.  The owner learns about
+// the call through its env_ipc_from, env_ipc_value and env_ipc_perm
+// fields, just as with sys_ipc_recv.
+static int
+ep_deliver(struct Env *owner, void *dstva, struct Env *caller)
+{
+	bool transferring_page = (caller->env_ep_srcva != (void *)-1) && (dstva != (void *)-1);
+	int r;
+
+	if (transferring_page &&
+	    (r = ipc_map_pages(caller, caller->env_ep_srcva, owner, dstva, 1, caller->env_ep_perm)) < 0)
+		return r;
+
+	owner->env_ipc_from = caller->env_id;
+	owner->env_ipc_value = caller->env_ep_value;
+	owner->env_ipc_perm = (transferring_page) ? caller->env_ep_perm : 0;
+	caller->env_ep_accepted = 1;
+	ipctrace_send(caller, owner, caller->env_ep_value, transferring_page);
+	return 0;
+}
+
+// Call endpoint 'epid' with 'value' and, if srcva != -1, the page at
+// 'srcva' mapped with 'perm'.  Block until the endpoint's owner replies.
+// If dstva != -1, a page sent with the reply is mapped there.
+//
+// If the owner is blocked in sys_ep_recv the call is handed over
+// immediately; otherwise it queues on the endpoint.
+//
+// Doesn't return on success: the system call returns the value passed
+// to sys_ep_reply, and env_ipc_perm is set as for sys_ipc_recv.
+// Returns < 0 on error.  Errors are:
+//	-E_BAD_ENV if there is no such endpoint, or curenv owns it.
+//	-E_INVAL if srcva or dstva is not -1 but is >= UTOP or not
+//		page-aligned, or perm is inappropriate (see sys_page_alloc).
+//	Any error of sys_ipc_try_send if the page can't be mapped.
+// If the owner dies before replying, the call returns -E_BAD_ENV.
+static int32_t
+sys_ep_call(int32_t epid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	struct Endpoint *ep;
+	struct Env *owner;
+	int r;
+
+	if (srcva != (void *)-1) {
+		if (((uintptr_t)srcva >= UTOP) || ((uintptr_t)srcva % PGSIZE != 0))
+			return -E_INVAL;
+		if (((perm & PTE_U) != PTE_U) || ((perm & ~PTE_SYSCALL) != 0))
+			return -E_INVAL;
+	}
+	if (dstva != (void *)-1 &&
+	    (((uintptr_t)dstva >= UTOP) || ((uintptr_t)dstva % PGSIZE != 0)))
+		return -E_INVAL;
+
+	if ((r = ep_lookup(epid, &ep)) < 0)
+		return r;
+	if ((r = envid2env(ep->ep_owner, &owner, 0)) < 0)
+		return r;
+	if (owner == curenv)
+		return -E_BAD_ENV;	// we'd wait for ourselves forever
+
+	curenv->env_ep_calling = epid;
+	curenv->env_ep_accepted = 0;
+	curenv->env_ep_value = value;
+	curenv->env_ep_srcva = srcva;
+	curenv->env_ep_perm = perm;
+	curenv->env_ep_dstva = dstva;
+
+	if (ep->ep_recving && owner->env_status == ENV_NOT_RUNNABLE) {
+		if ((r = ep_deliver(owner, ep->ep_dstva, curenv)) < 0) {
+			curenv->env_ep_calling = 0;
+			return r;
+		}
+		ep->ep_recving = 0;
+		owner->env_status = ENV_RUNNABLE;
+	} else {
+		ep_enqueue(ep, curenv);
+		// Let an owner that's busy waiting on something else know
+		// that it should come back to sys_ep_recv.
+		notify_post(owner, NOTIFY_IPC);
+	}
+
+	ipctrace_recv(curenv);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	// sys_ep_reply sets the real return value.
+	sys_yield();
+	return 0;
+}
+
+// Receive the next call on endpoint 'epid', which curenv must own.
+// If dstva != -1, the page sent with the call is mapped there.
+// Blocks if no call is waiting, unless 'nonblock' is set.
+//
+// The calling env's id is left in env_ipc_from; it is the capability
+// that sys_ep_reply needs, and stays valid until the reply is sent or
+// the caller dies.  The call's value and page permission are left in
+// env_ipc_value and env_ipc_perm.  Any number of calls can be received
+// before they are replied to.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if there is no such endpoint or curenv doesn't own it.
+//	-E_INVAL if dstva is not -1 but is >= UTOP or not page-aligned.
+//	-E_TIMEOUT if nonblock is set and no call is waiting.
+static int
+sys_ep_recv(int32_t epid, void *dstva, bool nonblock)
+{
+	struct Endpoint *ep;
+	struct Env *caller;
+	int r;
+
+	if ((r = ep_lookup(epid, &ep)) < 0)
+		return r;
+	if (ep->ep_owner != curenv->env_id)
+		return -E_BAD_ENV;
+	if (dstva != (void *)-1 &&
+	    (((uintptr_t)dstva >= UTOP) || ((uintptr_t)dstva % PGSIZE != 0)))
+		return -E_INVAL;
+
+	while ((caller = ep_dequeue(ep)) != NULL) {
+		if ((r = ep_deliver(curenv, dstva, caller)) == 0) {
+			// We never blocked, so we're "woken up" right away.
+			ipctrace_wake(curenv);
+			return 0;
+		}
+		// The call can't be delivered (say its page went away
+		// while it was queued), so fail it and try the next one.
+		caller->env_ep_calling = 0;
+		caller->env_tf.tf_regs.reg_eax = r;
+		caller->env_status = ENV_RUNNABLE;
+	}
+
+	if (nonblock)
+		return -E_TIMEOUT;
+
+	ep->ep_recving = 1;
+	ep->ep_dstva = dstva;
+	ipctrace_recv(curenv);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sys_yield();
+	return 0;
+}
+
+// Reply to the call made by env 'callerid', which curenv must have
+// received with sys_ep_recv and not yet replied to.  The caller's
+// sys_ep_call returns 'value'.  If srcva != -1 and the caller asked for
+// a reply page, the page at 'srcva' is mapped into the caller with 'perm'.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if callerid is not a live caller whose call curenv has
+//		received and not yet replied to.
+//	-E_INVAL etc. as for sys_ipc_try_send if the page can't be mapped.
+static int
+sys_ep_reply(envid_t callerid, int32_t value, void *srcva, int perm)
+{
+	struct Endpoint *ep;
+	struct Env *c;
+	int r;
+
+	if ((r = envid2env(callerid, &c, 0)) < 0)
+		return r;
+	if (!c->env_ep_calling || !c->env_ep_accepted)
+		return -E_BAD_ENV;
+	if (ep_lookup(c->env_ep_calling, &ep) < 0 || ep->ep_owner != curenv->env_id)
+		return -E_BAD_ENV;
+
+	bool transferring_page = (srcva != (void *)-1) && (c->env_ep_dstva != (void *)-1);
+	if (transferring_page &&
+	    (r = ipc_map_pages(curenv, srcva, c, c->env_ep_dstva, 1, perm)) < 0)
+		return r;
+
+	c->env_ipc_perm = (transferring_page) ? perm : 0;
+	ipctrace_send(curenv, c, value, transferring_page);
+	c->env_ep_calling = 0;
+	c->env_ep_accepted = 0;
+	c->env_tf.tf_regs.reg_eax = value;
+	c->env_status = ENV_RUNNABLE;
+	return 0;
+}
+
+// Can system call 'num' be run from a syscall ring?  Only calls that
+// never block or switch environments are allowed.
+static bool
+sysring_allowed(uint32_t num)
+{
+	switch (num) {
+	case SYS_getenvid:
+	case SYS_page_alloc:
+	case SYS_page_map:
+	case SYS_page_unmap:
+	case SYS_env_set_status:
+	case SYS_env_set_trapframe:
+	case SYS_env_set_pgfault_upcall:
+	case SYS_tx_pkt:
+	case SYS_notify_signal:
+	case SYS_null:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Run the system calls queued in the ring at 'ring', in order, storing
+// each one's return value in its entry.  Calls that aren't allowed in a
+// ring (see sysring_allowed) fail with -E_NOT_SUPP.
+// The ring is accessed through the kernel mapping of its page, so the
+// batch may safely remap the ring page itself (fork does); if the page
+// is unmapped or replaced, the remaining entries are not run.
+//
+// Returns the number of entries that failed, or < 0 on error.  Errors are:
+//	-E_FAULT if ring is not a page-aligned, user-writable page, or its
+//		indexes are inconsistent.
+static int
+sys_sysring_enter(struct Sysring *ring)
+{
+	struct PageInfo *pp;
+	struct Sysring *kr;
+	struct SysringEntry *se;
+	uint32_t head, tail;
+	pte_t *pte;
+	int nfailed = 0;
+
+	static_assert(sizeof(struct Sysring) <= PGSIZE);
+
+	if (((uintptr_t)ring >= UTOP) || ((uintptr_t)ring % PGSIZE != 0))
+		return -E_FAULT;
+	if (!(pp = page_lookup(curenv->env_pgdir, ring, &pte)) ||
+	    ((*pte & (PTE_U|PTE_W)) != (PTE_U|PTE_W)))
+		return -E_FAULT;
+
+	kr = page2kva(pp);
+	head = kr->sr_head;
+	tail = kr->sr_tail;
+	if (tail - head > SYSRING_SIZE)
+		return -E_FAULT;
+
+	for (; head != tail; head++) {
+		se = &kr->sr_ent[head % SYSRING_SIZE];
+		if (sysring_allowed(se->se_num))
+			se->se_ret = syscall(se->se_num, se->se_args[0], se->se_args[1],
+					     se->se_args[2], se->se_args[3], se->se_args[4]);
+		else
+			se->se_ret = -E_NOT_SUPP;
+		if (se->se_ret < 0)
+			nfailed++;
+		kr->sr_head = head + 1;
+
+		if (page_lookup(curenv->env_pgdir, ring, NULL) != pp)
+			break;
+	}
+	return nfailed;
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -427,26 +799,285 @@ sys_time_msec(void)
 }
 
 // Send a packet.
+// tx_pkt() copies straight from buf, so a bad buf costs nothing until it
+// actually faults, and then just returns -E_FAULT.
 static int
 sys_tx_pkt(const char *buf, size_t nbytes)
 {
-	user_mem_assert(curenv, (void *)buf, nbytes, 0);	// It's ok to be read-only.
 	return tx_pkt(buf, nbytes);
 }
 
-// Receive a packet.
+// Receive a packet into buf, which must have room for DESC_BUF_SZ bytes.
 static int
 sys_rx_pkt(char *buf)
 {
-	user_mem_assert(curenv, (void *)buf, DESC_BUF_SZ, 0);	// It's ok to be read-only.
 	// I shouldn't do a loop since there's only one kernel thread and I
 	// can't block it...
 	return rx_pkt(buf);
 }
 
+// Block until one of the notification bits in 'mask' is pending.
+// If 'timeout' is nonzero, give up after 'timeout' milliseconds; in that
+// case NOTIFY_TIMER is implicitly part of the mask.
+//
+// Returns the (nonzero) set of bits in the mask that were pending; they
+// are cleared from the env's notification word.  Bits outside the mask
+// stay pending.  If some bits are already pending, returns immediately.
+// Like sys_ipc_recv, this only returns directly if it doesn't block.
+// Errors are:
+//	-E_INVAL if mask is 0 and there's no timeout.
+static int
+sys_notify_wait(uint32_t mask, uint32_t timeout)
+{
+	uint32_t bits;
+
+	if (timeout)
+		mask |= NOTIFY_TIMER;
+	if (mask == 0)
+		return -E_INVAL;
+
+	if ((bits = curenv->env_notify_pending & mask) != 0) {
+		curenv->env_notify_pending &= ~bits;
+		return bits;
+	}
+
+	curenv->env_notify_mask = mask;
+	if (timeout)
+		timer_arm(curenv, time_usec() + timeout * 1000ULL);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	// notify_post() fills in the real return value when it wakes us.
+	sys_yield();
+	return 0;
+}
+
+// Post the notification bits 'bits' to environment 'envid'.
+// Only the NOTIFY_USER bits may be posted by environments; the
+// others mean something to the kernel.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//		(No need to check permissions, just like IPC.)
+//	-E_INVAL if 'bits' is 0 or contains non-user bits.
+static int
+sys_notify_signal(envid_t envid, uint32_t bits)
+{
+	struct Env *e;
+
+	if (bits == 0 || (bits & ~NOTIFY_USER))
+		return -E_INVAL;
+	if (envid2env(envid, &e, 0) < 0)
+		return -E_BAD_ENV;
+
+	notify_post(e, bits);
+	return 0;
+}
+
+// Is 'e' the network server?  It takes packets in and out in helper
+// environments it forks, so those count too.
+static bool
+env_is_ns(struct Env *e)
+{
+	struct Env *parent;
+
+	if (e->env_type == ENV_TYPE_NS)
+		return 1;
+	return e->env_parent_id != 0
+		&& envid2env(e->env_parent_id, &parent, 0) == 0
+		&& parent->env_type == ENV_TYPE_NS;
+}
+
+// Have the device notifications in 'bits' (NOTIFY_NET and/or
+// NOTIFY_DISK) delivered to the current environment, replacing any
+// environment that was bound to them before.  Only the network server
+// may take NOTIFY_NET, and only the file system server NOTIFY_DISK.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the environment may not take one of the bits.
+//	-E_INVAL if 'bits' contains other bits.
+static int
+sys_notify_bind(uint32_t bits)
+{
+	if ((bits & NOTIFY_NET) && !env_is_ns(curenv))
+		return -E_BAD_ENV;
+	if ((bits & NOTIFY_DISK) && curenv->env_type != ENV_TYPE_FS)
+		return -E_BAD_ENV;
+	return notify_bind(curenv, bits);
+}
+
+// Block until time_usec() reaches 'deadline'.
+// Returns 0 (right away if the deadline has already passed).
+static int
+sys_sleep_until(uint64_t deadline)
+{
+	if (deadline <= time_usec())
+		return 0;
+
+	timer_arm(curenv, deadline);
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	// timer_expire() fills in the real return value when it wakes us.
+	sys_yield();
+	return 0;
+}
+
+// Copy up to 'n' profiler samples taken while environment 'envid' (or,
+// if envid is 0, any environment) was running in user mode into
+// 'samples'.  Returns the number of samples copied, or -E_FAULT.
+static int
+sys_prof_read(envid_t envid, struct ProfSample *samples, size_t n)
+{
+	return prof_read(envid, samples, n);
+}
+
+// Return the I/O port base of the IDE bus-master registers, for the
+// file system's DMA driver.
+// Returns -E_BAD_ENV if the caller isn't the file system environment,
+// or -E_NOT_SUPP if no PIIX IDE controller was found.
+static int
+sys_ide_bmbase(void)
+{
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_BAD_ENV;
+	if (!piix_bmbase)
+		return -E_NOT_SUPP;
+	return piix_bmbase;
+}
+
+// Return the physical address that 'va' maps to in the current
+// environment, so the file system can point DMA at its own pages.
+// The file system can already reach all of memory through the
+// bus-master registers, so telling it where its pages are gives away
+// nothing new; nobody else may ask.
+// Returns -E_BAD_ENV if the caller isn't the file system environment,
+// or -E_FAULT if va is above UTOP or not mapped.
+static int
+sys_page_paddr(void *va)
+{
+	struct PageInfo *pp;
+
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_BAD_ENV;
+	if ((uintptr_t) va >= UTOP
+	    || !(pp = page_lookup(curenv->env_pgdir, va, NULL)))
+		return -E_FAULT;
+	return page2pa(pp) | PGOFF(va);
+}
+
+// Per-CPU statistics for each system call, so that accounting doesn't
+// bounce cache lines between CPUs.  Summed up by sysstat_sum().
+static struct SysStat sysstats[NCPU][NSYSCALLS];
+
+static const char * const syscall_names[NSYSCALLS] = {
+	[SYS_cputs]			= "cputs",
+	[SYS_cgetc]			= "cgetc",
+	[SYS_getenvid]			= "getenvid",
+	[SYS_env_destroy]		= "env_destroy",
+	[SYS_page_alloc]		= "page_alloc",
+	[SYS_page_map]			= "page_map",
+	[SYS_page_unmap]		= "page_unmap",
+	[SYS_exofork]			= "exofork",
+	[SYS_env_set_status]		= "env_set_status",
+	[SYS_env_set_trapframe]		= "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall]	= "env_set_pgfault_upcall",
+	[SYS_yield]			= "yield",
+	[SYS_ipc_try_send]		= "ipc_try_send",
+	[SYS_ipc_recv]			= "ipc_recv",
+	[SYS_time_msec]			= "time_msec",
+	[SYS_tx_pkt]			= "tx_pkt",
+	[SYS_rx_pkt]			= "rx_pkt",
+	[SYS_ipc_try_send_range]	= "ipc_try_send_range",
+	[SYS_notify_wait]		= "notify_wait",
+	[SYS_notify_signal]		= "notify_signal",
+	[SYS_notify_bind]		= "notify_bind",
+	[SYS_ep_create]			= "ep_create",
+	[SYS_ep_call]			= "ep_call",
+	[SYS_ep_recv]			= "ep_recv",
+	[SYS_ep_reply]			= "ep_reply",
+	[SYS_null]			= "null",
+	[SYS_sysring_enter]		= "sysring_enter",
+	[SYS_sleep_until]		= "sleep_until",
+	[SYS_prof_read]			= "prof_read",
+	[SYS_ktrace]			= "ktrace",
+	[SYS_sysstat]			= "sysstat",
+	[SYS_ide_bmbase]		= "ide_bmbase",
+	[SYS_page_paddr]		= "page_paddr",
+};
+
+// Add up the per-CPU statistics for system call 'num' into 'ss'.
+static void
+sysstat_sum(int num, struct SysStat *ss)
+{
+	int cpu;
+
+	memset(ss, 0, sizeof(*ss));
+	for (cpu = 0; cpu < NCPU; cpu++) {
+		struct SysStat *s = &sysstats[cpu][num];
+
+		ss->ss_calls += s->ss_calls;
+		ss->ss_timed += s->ss_timed;
+		ss->ss_errors += s->ss_errors;
+		ss->ss_cycles += s->ss_cycles;
+		ss->ss_max = MAX(ss->ss_max, s->ss_max);
+	}
+}
+
+// Copy the statistics of all NSYSCALLS system calls, summed over all
+// CPUs, into the array 'stats', indexed by system call number.
+// Returns NSYSCALLS, or -E_FAULT.
+static int
+sys_sysstat(struct SysStat *stats)
+{
+	struct SysStat ss;
+	int num, r;
+
+	for (num = 0; num < NSYSCALLS; num++) {
+		sysstat_sum(num, &ss);
+		if ((r = copyout(&stats[num], &ss, sizeof(ss))) < 0)
+			return r;
+	}
+	return NSYSCALLS;
+}
+
+int
+mon_sysstat(int argc, char **argv, struct Trapframe *tf)
+{
+	struct SysStat ss;
+	int num;
+
+	if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+		memset(sysstats, 0, sizeof(sysstats));
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: sysstat [reset]\n");
+		return 0;
+	}
+
+	cprintf("%-24s %10s %8s %8s %12s %12s\n", "syscall", "calls",
+		"blocked", "errors", "avg cycles", "max cycles");
+	for (num = 0; num < NSYSCALLS; num++) {
+		sysstat_sum(num, &ss);
+		if (!ss.ss_calls)
+			continue;
+		cprintf("%-24s %10u %8u %8u %12llu %12llu\n", syscall_names[num],
+			ss.ss_calls, ss.ss_calls - ss.ss_timed, ss.ss_errors,
+			ss.ss_timed ? ss.ss_cycles / ss.ss_timed : 0,
+			ss.ss_max);
+	}
+	return 0;
+}
+
+// Log a KT_USER event in the kernel trace: 'code' is one of the KTU_*
+// codes, 'arg' depends on it.  Returns 0.
+static int
+sys_ktrace(uint32_t code, uint32_t arg)
+{
+	TRACE(KT_USER, code, arg);
+	return 0;
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
-int32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+static int32_t
+syscall_dispatch(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -481,18 +1112,81 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		return 0;
 	case SYS_ipc_try_send:
 		return (int32_t) sys_ipc_try_send((envid_t)a1, (uint32_t)a2, (void *)a3, (unsigned)a4);
+	case SYS_ipc_try_send_range:
+		return (int32_t) sys_ipc_try_send_range((envid_t)a1, (uint32_t)a2, (void *)a3, (size_t)a4, (unsigned)a5);
 	case SYS_ipc_recv:
 		// this syscall calls sys_yield(). this will never return if successful
 		// does return error code, though.
-		return (int32_t) sys_ipc_recv((void *)a1);
+		return (int32_t) sys_ipc_recv((void *)a1, (size_t)a2, ((uint64_t)a4 << 32) | a3);
 	case SYS_time_msec:
 		return (int32_t) sys_time_msec();
 	case SYS_tx_pkt:
 		return (int32_t) sys_tx_pkt((const char *)a1, (size_t)a2);
 	case SYS_rx_pkt:
 		return (int32_t) sys_rx_pkt((char *)a1);
+	case SYS_notify_wait:
+		// Like SYS_ipc_recv, doesn't return here if it blocks.
+		return (int32_t) sys_notify_wait((uint32_t)a1, (uint32_t)a2);
+	case SYS_notify_signal:
+		return (int32_t) sys_notify_signal((envid_t)a1, (uint32_t)a2);
+	case SYS_notify_bind:
+		return (int32_t) sys_notify_bind((uint32_t)a1);
+	case SYS_ep_create:
+		return sys_ep_create();
+	case SYS_ep_call:
+		// Like SYS_ipc_recv, doesn't return here on success.
+		return sys_ep_call((int32_t)a1, (uint32_t)a2, (void *)a3, (int)a4, (void *)a5);
+	case SYS_ep_recv:
+		return (int32_t) sys_ep_recv((int32_t)a1, (void *)a2, (bool)a3);
+	case SYS_ep_reply:
+		return (int32_t) sys_ep_reply((envid_t)a1, (int32_t)a2, (void *)a3, (int)a4);
+	case SYS_null:
+		// Does nothing; for measuring system call overhead.
+		return 0;
+	case SYS_sysring_enter:
+		return (int32_t) sys_sysring_enter((struct Sysring *)a1);
+	case SYS_sleep_until:
+		// Like SYS_ipc_recv, doesn't return here if it blocks.
+		return (int32_t) sys_sleep_until(((uint64_t)a2 << 32) | a1);
+	case SYS_prof_read:
+		return (int32_t) sys_prof_read((envid_t)a1, (struct ProfSample *)a2, (size_t)a3);
+	case SYS_ktrace:
+		return (int32_t) sys_ktrace((uint32_t)a1, (uint32_t)a2);
+	case SYS_sysstat:
+		return (int32_t) sys_sysstat((struct SysStat *)a1);
+	case SYS_ide_bmbase:
+		return (int32_t) sys_ide_bmbase();
+	case SYS_page_paddr:
+		return (int32_t) sys_page_paddr((void *)a1);
 	default:
 		return -E_UNSPECIFIED;
 	}
 }
 
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct SysStat *ss = NULL;
+	uint64_t start, cycles;
+	int32_t ret;
+
+	TRACE(KT_SYSCALL, syscallno, a1);
+	if (syscallno < NSYSCALLS) {
+		ss = &sysstats[cpunum()][syscallno];
+		ss->ss_calls++;
+	}
+	start = read_tsc();
+	ret = syscall_dispatch(syscallno, a1, a2, a3, a4, a5);
+
+	// Blocking calls that switch to another env never get here.
+	if (ss) {
+		cycles = read_tsc() - start;
+		ss->ss_timed++;
+		ss->ss_cycles += cycles;
+		ss->ss_max = MAX(ss->ss_max, cycles);
+		if (ret < 0)
+			ss->ss_errors++;
+	}
+	TRACE(KT_SYSRET, syscallno, ret);
+	return ret;
+}
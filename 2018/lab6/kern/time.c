@@ -0,0 +1,107 @@
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/vdso.h>
+
+#include <kern/time.h>
+#include <kern/cpu.h>
+
+// PIT channel 2 is the reference clock for calibration: its gate and
+// output are wired to port B of the keyboard controller, so we can run
+// it and watch it finish without taking an interrupt.
+#define PIT_FREQ	1193182
+#define IO_PIT_CH2	0x42
+#define IO_PIT_MODE	0x43
+#define IO_PORTB	0x61
+#define PORTB_GATE2	0x01	// channel 2 gate
+#define PORTB_SPKR	0x02	// speaker data enable
+#define PORTB_OUT2	0x20	// channel 2 output
+#define CALIBRATE_MS	10
+
+static unsigned int ticks;
+static uint64_t tsc_boot;	// read_tsc() at time_init()
+static uint32_t tsc_khz;	// TSC cycles per millisecond
+static uint32_t lapic_khz;	// LAPIC timer counts per millisecond
+
+// Measure the TSC and LAPIC timer rates against CALIBRATE_MS of PIT
+// channel 2 counting down in mode 0 (output goes high at terminal count).
+static void
+calibrate(void)
+{
+	uint32_t latch = PIT_FREQ * CALIBRATE_MS / 1000;
+	uint64_t tsc0, tsc1;
+	uint32_t apic0, apic1;
+
+	outb(IO_PORTB, (inb(IO_PORTB) & ~PORTB_SPKR) | PORTB_GATE2);
+	outb(IO_PIT_MODE, 0xb0);	// channel 2, lobyte/hibyte, mode 0
+	outb(IO_PIT_CH2, latch & 0xff);
+	outb(IO_PIT_CH2, latch >> 8);
+
+	lapic_timer_oneshot(0xffffffff);
+	apic0 = lapic_timer_current();
+	tsc0 = read_tsc();
+	while ((inb(IO_PORTB) & PORTB_OUT2) == 0)
+		;
+	tsc1 = read_tsc();
+	apic1 = lapic_timer_current();
+
+	tsc_khz = (tsc1 - tsc0) / CALIBRATE_MS;
+	lapic_khz = (apic0 - apic1) / CALIBRATE_MS;
+}
+
+void
+time_init(void)
+{
+	extern struct Vdso *vdso;
+
+	ticks = 0;
+	calibrate();
+	tsc_boot = read_tsc();
+	cprintf("TSC %u kHz, LAPIC timer %u kHz\n", tsc_khz, lapic_khz);
+
+	// Let environments compute time_usec() themselves.
+	vdso->vd_tsc_khz = tsc_khz;
+	vdso->vd_tsc_boot = tsc_boot;
+
+	// Switch the BSP's timer to one-shot mode (see kern/timer.c).
+	// The APs start in one-shot mode since they come up later.
+	lapic_timer_oneshot(time_lapic_count(TICK_USEC));
+}
+
+// This should be called once per scheduler tick on the boot CPU.
+// A tick happens every TICK_USEC.
+void
+time_tick(void)
+{
+	ticks++;
+	if (ticks * 10 < ticks)
+		panic("time_tick: time overflowed");
+}
+
+// Microseconds since time_init(), from the TSC.
+uint64_t
+time_usec(void)
+{
+	if (!tsc_khz)
+		return 0;
+	return (read_tsc() - tsc_boot) * 1000 / tsc_khz;
+}
+
+unsigned int
+time_msec(void)
+{
+	return time_usec() / 1000;
+}
+
+// The LAPIC timer count for an interval of 'usec', clamped to what the
+// timer can hold.  Returns 0 before time_init().
+uint32_t
+time_lapic_count(uint64_t usec)
+{
+	uint64_t count = usec * lapic_khz / 1000;
+
+	if (!lapic_khz)
+		return 0;
+	if (count == 0)
+		return 1;
+	return count > 0xffffffff ? 0xffffffff : count;
+}
@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_TIME_H
+#define JOS_KERN_TIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Each CPU gets a scheduler tick this often.
+#define TICK_USEC	10000
+
+void time_init(void);
+void time_tick(void);
+unsigned int time_msec(void);
+uint64_t time_usec(void);
+uint32_t time_lapic_count(uint64_t usec);
+
+#endif /* JOS_KERN_TIME_H */
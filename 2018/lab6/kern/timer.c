@@ -0,0 +1,224 @@
+// Kernel timers.
+//
+// An environment blocked with a deadline -- in sys_sleep_until(), in a
+// timed sys_ipc_recv() or in sys_notify_wait() with a timeout -- sits
+// in a hierarchical timer wheel until its deadline (env_timeout, in
+// time_usec() microseconds) passes.
+//
+// The wheel counts time in jiffies of JIFFY_USEC.  It has WHEEL_LEVELS
+// levels of WHEEL_SLOTS slots each; a slot of level n covers
+// WHEEL_SLOTS^n jiffies, so the four levels reach about 71 minutes out
+// (later deadlines wait in the last slot and are re-filed as it comes
+// round).  Arming and cancelling a timer are O(1).  Each time the
+// wheel advances a jiffy it expires one level-0 slot, and whenever a
+// level wraps around it re-files the next slot of the level above into
+// the finer levels below, so expiry is O(1) per timer as well.
+//
+// Every CPU runs its LAPIC timer in one-shot mode, programmed for the
+// earlier of its next scheduler tick and the next non-empty level-0
+// slot, so a timer fires within JIFFY_USEC plus the interrupt latency
+// of its deadline rather than at the next 10ms tick.  Whichever CPU
+// takes the interrupt advances the wheel; the big kernel lock protects
+// it.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/notify.h>
+#include <kern/time.h>
+#include <kern/timer.h>
+
+#define JIFFY_SHIFT	8
+#define JIFFY_USEC	(1 << JIFFY_SHIFT)	// 256us
+#define WHEEL_BITS	6
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_SPAN	(1ULL << (WHEEL_BITS * WHEEL_LEVELS))	// jiffies
+
+static struct Env *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t wheel_used[WHEEL_LEVELS];	// bitmap of non-empty slots
+static uint64_t wheel_jiffy;		// next jiffy to expire
+static unsigned int wheel_count;	// number of armed timers
+static uint64_t next_tick[NCPU];	// time_usec() of each CPU's next tick
+
+// First jiffy at or after 'usec', so timers never fire early.
+static uint64_t
+usec2jiffy(uint64_t usec)
+{
+	return (usec + JIFFY_USEC - 1) >> JIFFY_SHIFT;
+}
+
+// File e in the slot for its deadline, relative to wheel_jiffy.
+static void
+wheel_add(struct Env *e)
+{
+	uint64_t j = usec2jiffy(e->env_timeout);
+	int level, slot;
+
+	if (j < wheel_jiffy)
+		j = wheel_jiffy;
+	if (j - wheel_jiffy >= WHEEL_SPAN)
+		j = wheel_jiffy + WHEEL_SPAN - 1;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (j - wheel_jiffy < (1ULL << (WHEEL_BITS * (level + 1))))
+			break;
+	slot = (j >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	e->env_timer_link = wheel[level][slot];
+	if (e->env_timer_link)
+		e->env_timer_link->env_timer_pprev = &e->env_timer_link;
+	e->env_timer_pprev = &wheel[level][slot];
+	wheel[level][slot] = e;
+	wheel_used[level] |= 1ULL << slot;
+}
+
+// Take slot 'slot' of level 'level' off the wheel and return its list.
+static struct Env *
+wheel_take(int level, int slot)
+{
+	struct Env *list = wheel[level][slot];
+
+	wheel[level][slot] = NULL;
+	wheel_used[level] &= ~(1ULL << slot);
+	return list;
+}
+
+// Wake up e, whose deadline has passed, from whatever it was blocked in.
+static void
+timer_expire(struct Env *e)
+{
+	if (e->env_status != ENV_NOT_RUNNABLE)
+		return;
+	if (e->env_notify_mask) {
+		// sys_notify_wait(): notify_post() does the waking
+		notify_post(e, NOTIFY_TIMER);
+		return;
+	}
+	if (e->env_ipc_recving) {
+		e->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	} else	// sys_sleep_until()
+		e->env_tf.tf_regs.reg_eax = 0;
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Expire the timers of jiffy wheel_jiffy and move on to the next one,
+// first re-filing higher-level slots that come due.
+static void
+wheel_step(void)
+{
+	struct Env *e, *next;
+	int level, slot;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if ((wheel_jiffy >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+			break;
+		slot = (wheel_jiffy >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		for (e = wheel_take(level, slot); e; e = next) {
+			next = e->env_timer_link;
+			wheel_add(e);
+		}
+	}
+
+	slot = wheel_jiffy & WHEEL_MASK;
+	for (e = wheel_take(0, slot); e; e = next) {
+		next = e->env_timer_link;
+		e->env_timeout = 0;
+		e->env_timer_link = NULL;
+		e->env_timer_pprev = NULL;
+		wheel_count--;
+		timer_expire(e);
+	}
+	wheel_jiffy++;
+}
+
+// time_usec() of the next jiffy the wheel has to look at: a non-empty
+// level-0 slot, or the next time level 0 wraps around and the levels
+// above re-file their timers.  ~0 if no timers are armed.
+static uint64_t
+wheel_next(void)
+{
+	int idx = wheel_jiffy & WHEEL_MASK;
+	uint64_t used;
+
+	if (!wheel_count)
+		return ~0ULL;
+	used = wheel_used[0] >> idx;
+	if (used)
+		return (wheel_jiffy + __builtin_ctzll(used)) << JIFFY_SHIFT;
+	return ((wheel_jiffy | WHEEL_MASK) + 1) << JIFFY_SHIFT;
+}
+
+// Program this CPU's LAPIC timer for its next event.
+static void
+timer_program(uint64_t now)
+{
+	uint64_t when = MIN(next_tick[cpunum()], wheel_next());
+
+	lapic_timer_oneshot(time_lapic_count(when > now ? when - now : 0));
+}
+
+// Wake e up once time_usec() reaches 'deadline', unless something else
+// wakes it first and calls timer_cancel().  Replaces any earlier timer.
+void
+timer_arm(struct Env *e, uint64_t deadline)
+{
+	uint64_t now = time_usec();
+
+	assert(deadline != 0);
+	timer_cancel(e);
+
+	// With nothing armed the wheel doesn't advance; catch it up.
+	if (!wheel_count)
+		wheel_jiffy = now >> JIFFY_SHIFT;
+
+	e->env_timeout = deadline;
+	wheel_add(e);
+	wheel_count++;
+
+	// The new timer may be due before this CPU's next interrupt.
+	// Other CPUs keep their old deadlines; they'll just find nothing
+	// to do when they get there.
+	timer_program(now);
+}
+
+// Disarm e's timer, if it has one.
+void
+timer_cancel(struct Env *e)
+{
+	if (!e->env_timeout)
+		return;
+	if (e->env_timer_link)
+		e->env_timer_link->env_timer_pprev = e->env_timer_pprev;
+	*e->env_timer_pprev = e->env_timer_link;
+	e->env_timeout = 0;
+	e->env_timer_link = NULL;
+	e->env_timer_pprev = NULL;
+	wheel_count--;
+}
+
+// Called from the timer interrupt on every CPU.  Expires the timers
+// that are due and programs this CPU's next interrupt.
+// Returns 1 if this CPU's scheduler tick is due, 0 if the interrupt
+// was only for timers.
+int
+timer_intr(void)
+{
+	uint64_t now = time_usec();
+	uint64_t *tick = &next_tick[cpunum()];
+	int r = 0;
+
+	while (wheel_count && wheel_jiffy <= (now >> JIFFY_SHIFT))
+		wheel_step();
+
+	if (now >= *tick) {
+		*tick = now + TICK_USEC;
+		r = 1;
+	}
+	timer_program(now);
+	return r;
+}
@@ -0,0 +1,13 @@
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void timer_arm(struct Env *e, uint64_t deadline);
+void timer_cancel(struct Env *e);
+int timer_intr(void);
+
+#endif	// !JOS_KERN_TIMER_H
@@ -2,6 +2,7 @@
 #include <inc/x86.h>
 #include <inc/assert.h>
 #include <inc/error.h>
+#include <inc/vdso.h>
 
 #include <kern/pmap.h>
 #include <kern/trap.h>
@@ -15,9 +16,26 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/notify.h>
+#include <kern/e1000.h>
+#include <kern/usercopy.h>
+#include <kern/timer.h>
+#include <kern/prof.h>
+#include <kern/ktrace.h>
 
 static struct Taskstate ts;
 
+// MSRs used by sysenter, see the Intel SDM vol. 2B, "SYSENTER"
+#define MSR_IA32_SYSENTER_CS	0x174
+#define MSR_IA32_SYSENTER_ESP	0x175
+#define MSR_IA32_SYSENTER_EIP	0x176
+
+static inline void
+wrmsr(uint32_t msr, uint32_t lo, uint32_t hi)
+{
+	asm volatile("wrmsr" : : "c" (msr), "a" (lo), "d" (hi));
+}
+
 /* For debugging, so print_trapframe can distinguish between printing
  * a saved trapframe and printing the current trapframe and print some
  * additional information in the latter case.
@@ -208,6 +226,14 @@ trap_init_percpu(void)
 
 	// Load the IDT
 	lidt(&idt_pd);
+
+	// Set up the fast system call entry for this CPU.  sysenter uses
+	// the same kernel stack as a trap would; SS is taken to be CS + 8
+	// (GD_KD), and sysexit goes back to CS + 16 (GD_UT) and CS + 24 (GD_UD).
+	void sysenter_handler();
+	wrmsr(MSR_IA32_SYSENTER_CS, GD_KT, 0);
+	wrmsr(MSR_IA32_SYSENTER_ESP, thiscpu->cpu_ts.ts_esp0, 0);
+	wrmsr(MSR_IA32_SYSENTER_EIP, (uint32_t) sysenter_handler, 0);
 }
 
 void
@@ -256,12 +282,31 @@ print_regs(struct PushRegs *regs)
 	cprintf("  eax  0x%08x\n", regs->reg_eax);
 }
 
+// Acknowledge an 8259 interrupt.  The master is in auto-EOI mode, but
+// the slave, which IRQs 8-15 come through, isn't: until it gets an
+// EOI, its in-service bit holds off that IRQ and every lower-priority
+// one on it.  The EOI goes to both, as the slave cascades through the
+// master.
+static void
+irq_eoi(void)
+{
+	outb(IO_PIC2, 0x20);	// OCW2: non-specific EOI
+	outb(IO_PIC1, 0x20);
+}
+
 static void
 trap_dispatch(struct Trapframe *tf)
 {
 	// Handle processor exceptions.
 	// LAB 3: Your code here.
 
+	// The e1000's IRQ line comes from PCI, so it can't be a case label.
+	if (e1000_irq >= 0 && tf->tf_trapno == IRQ_OFFSET + e1000_irq) {
+		e1000_intr();
+		irq_eoi();
+		return;
+	}
+
 	switch (tf->tf_trapno) {
 	case T_DEBUG:
 		monitor(tf);
@@ -280,12 +325,23 @@ trap_dispatch(struct Trapframe *tf)
 	case IRQ_OFFSET + IRQ_TIMER:
 		lapic_eoi();
 
+		// The LAPIC timer is one-shot; it fires for kernel timers as
+		// well as for this CPU's scheduler tick.  Only a tick preempts.
+		if (!timer_intr())
+			break;
+		prof_sample(tf);
+
 		// Add time tick increment to clock interrupts.
 		// Be careful! In multiprocessors, clock interrupts are
 		// triggered on every CPU.
 		// LAB 6: Your code here.
-		if (thiscpu == bootcpu)
+		if (thiscpu == bootcpu) {
+			extern struct Vdso *vdso;
+
 			time_tick();
+			vdso->vd_ticks++;
+			vdso->vd_msec = time_msec();
+		}
 
 		sched_yield();
 		// shouldn't reach here...
@@ -301,6 +357,14 @@ trap_dispatch(struct Trapframe *tf)
 		serial_intr();
 		break;
 
+	// Only unmasked once someone binds NOTIFY_DISK.
+	// Reading the status register acknowledges the interrupt.
+	case IRQ_OFFSET + IRQ_IDE:
+		inb(0x1F7);
+		notify_irq(NOTIFY_DISK);
+		irq_eoi();
+		break;
+
 	// Handle spurious interrupts
 	// The hardware sometimes raises these because of noise on the
 	// IRQ line or other reasons. We don't care.
@@ -389,6 +453,7 @@ trap(struct Trapframe *tf)
 	// Record that tf is the last real trapframe so
 	// print_trapframe can print some additional information.
 	last_tf = tf;
+	TRACE(KT_TRAP, tf->tf_trapno, tf->tf_eip);
 
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
@@ -402,6 +467,61 @@ trap(struct Trapframe *tf)
 		sched_yield();
 }
 
+// Called from sysenter_handler with a Trapframe built on the kernel
+// stack.  Same as trap() for a T_SYSCALL from user mode, except that
+// if the current environment can keep running it goes back via sysexit
+// instead of iret.
+void
+sysenter_trap(struct Trapframe *tf)
+{
+	// Halt the CPU if some other CPU has called panic()
+	extern char *panicstr;
+	if (panicstr)
+		asm volatile("hlt");
+
+	assert(!(read_eflags() & FL_IF));
+	assert(curenv);
+	lock_kernel();
+
+	// Garbage collect if current enviroment is a zombie
+	if (curenv->env_status == ENV_DYING) {
+		env_free(curenv);
+		curenv = NULL;
+		sched_yield();
+	}
+
+	curenv->env_tf = *tf;
+	tf = &curenv->env_tf;
+	last_tf = tf;
+
+	// %esi carried the return eip, not a fifth argument; the stub
+	// only comes this way when a5 is 0.
+	tf->tf_regs.reg_esi = 0;
+
+	trap_dispatch(tf);
+
+	if (curenv && curenv->env_status == ENV_RUNNING)
+		env_sysexit(&curenv->env_tf);
+	else
+		sched_yield();
+}
+
+// Resume kernel code that trapped, at tf->tf_eip.
+// A trap from kernel mode doesn't push esp and ss, so the trap frame
+// ends at tf_eflags and iret leaves us on the stack we trapped from.
+static void __attribute__((noreturn))
+kernel_pop_tf(struct Trapframe *tf)
+{
+	asm volatile(
+		"\tmovl %0,%%esp\n"
+		"\tpopal\n"
+		"\tpopl %%es\n"
+		"\tpopl %%ds\n"
+		"\taddl $0x8,%%esp\n" /* skip tf_trapno and tf_errcode */
+		"\tiret\n"
+		: : "g" (tf) : "memory");
+	panic("iret failed");  /* mostly to placate the compiler */
+}
 
 void
 page_fault_handler(struct Trapframe *tf)
@@ -415,7 +535,14 @@ page_fault_handler(struct Trapframe *tf)
 
 	// LAB 3: Your code here.
 	if ((tf->tf_cs & 3) == 0) {	// kernel mode
-		panic("trap_dispatch: page fault happened in kernel mode!\n");
+		// A copyin()/copyout() touching bad user memory is expected;
+		// make it return -E_FAULT.  Anything else is a kernel bug.
+		uintptr_t fixup = fixup_lookup(tf->tf_eip);
+
+		if (!fixup)
+			panic("trap_dispatch: page fault happened in kernel mode!\n");
+		tf->tf_eip = fixup;
+		kernel_pop_tf(tf);
 	}
 
 	// We've already handled kernel-mode exceptions, so if we get here,
@@ -455,25 +582,26 @@ page_fault_handler(struct Trapframe *tf)
 		goto bad;
 	
 	int recursive = (tf->tf_esp >= UXSTACKTOP - PGSIZE) && (tf->tf_esp < UXSTACKTOP);
-	struct UTrapframe *utf;
+	struct UTrapframe *utf, frame;
 
-	if (recursive) {
+	if (recursive)
 		utf = (struct UTrapframe*)(tf->tf_esp - sizeof(uint32_t) - sizeof(struct UTrapframe));
-		user_mem_assert(curenv, (void *)utf, tf->tf_esp - (uintptr_t)utf, PTE_W);
-	} else {
+	else
 		utf = (struct UTrapframe*)(UXSTACKTOP - sizeof(struct UTrapframe));
-		user_mem_assert(curenv, (void *)utf, UXSTACKTOP - (uintptr_t)utf, PTE_W);
-	}
 
-	utf->utf_esp = tf->tf_esp;	// Yes we will push the return address onto trap-time stack,
+	// An overflowing recursive frame runs off the bottom of the exception
+	// stack into the empty page below it, so copyout() catches that too.
+	frame.utf_esp = tf->tf_esp;	// Yes we will push the return address onto trap-time stack,
 								// so this value need to be reduced by 4 before being popped 
 								// into %esp later in _pgfault_upcall... But we will do it in
 								// _pgfault_upcall.
-	utf->utf_eflags = tf->tf_eflags;
-	utf->utf_eip = tf->tf_eip;
-	utf->utf_regs = tf->tf_regs;
-	utf->utf_err = tf->tf_err;
-	utf->utf_fault_va = fault_va;
+	frame.utf_eflags = tf->tf_eflags;
+	frame.utf_eip = tf->tf_eip;
+	frame.utf_regs = tf->tf_regs;
+	frame.utf_err = tf->tf_err;
+	frame.utf_fault_va = fault_va;
+	if (copyout(utf, &frame, sizeof(frame)) < 0)
+		goto bad;
 
 	// Prepare to call env_run()
 	tf->tf_eip = (uintptr_t)curenv->env_pgfault_upcall;
@@ -0,0 +1,55 @@
+// Copying to and from user memory.
+//
+// Instead of walking the page tables for every page of a user buffer
+// up front (user_mem_check), just do the copy, and let the page fault
+// handler redirect a faulting copy to an error return through the
+// exception fixup table.  The only up-front check is that the user
+// side of the copy is entirely below ULIM (UTOP for writes), so a user
+// can't make us read or write the kernel on its behalf.
+
+#include <inc/error.h>
+#include <inc/memlayout.h>
+
+#include <kern/usercopy.h>
+
+int copy_user(void *dst, const void *src, size_t len);
+extern struct Fixup fixups[];
+
+// Copy 'len' bytes from user address 'usrc' into 'dst'.
+// Returns 0 on success, -E_FAULT if any part of the user range is not
+// readable by the user.
+int
+copyin(void *dst, const void *usrc, size_t len)
+{
+	uintptr_t va = (uintptr_t) usrc;
+
+	if (va + len < va || va + len > ULIM)
+		return -E_FAULT;
+	return copy_user(dst, usrc, len) ? -E_FAULT : 0;
+}
+
+// Copy 'len' bytes from 'src' to user address 'udst'.
+// Returns 0 on success, -E_FAULT if any part of the user range is not
+// writable by the user.  Copy-on-write pages count as not writable.
+int
+copyout(void *udst, const void *src, size_t len)
+{
+	uintptr_t va = (uintptr_t) udst;
+
+	if (va + len < va || va + len > UTOP)
+		return -E_FAULT;
+	return copy_user(udst, src, len) ? -E_FAULT : 0;
+}
+
+// Return where a kernel-mode page fault at 'eip' should resume,
+// or 0 if it is a genuine kernel bug.
+uintptr_t
+fixup_lookup(uintptr_t eip)
+{
+	struct Fixup *fx;
+
+	for (fx = fixups; fx->fx_start; fx++)
+		if (eip >= fx->fx_start && eip < fx->fx_end)
+			return fx->fx_handler;
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef JOS_KERN_USERCOPY_H
+#define JOS_KERN_USERCOPY_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// An entry in the exception fixup table: a page fault in kernel mode at
+// an eip in [fx_start, fx_end) resumes at fx_handler instead of panicking.
+struct Fixup {
+	uintptr_t fx_start;
+	uintptr_t fx_end;
+	uintptr_t fx_handler;
+};
+
+int copyin(void *dst, const void *usrc, size_t len);
+int copyout(void *udst, const void *src, size_t len);
+uintptr_t fixup_lookup(uintptr_t eip);
+
+#endif	// !JOS_KERN_USERCOPY_H
@@ -2,12 +2,39 @@
 
 #include <inc/syscall.h>
 #include <inc/lib.h>
+#include <inc/vdso.h>
+#include <inc/x86.h>
+
+// Enter the kernel with sysenter rather than int $T_SYSCALL whenever
+// possible.  Cleared by benchmarks that want to compare the two.
+bool syscall_use_sysenter = 1;
 
 static inline int32_t
 syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	int32_t ret;
 
+	// Fast path: sysenter saves neither the return %eip nor %esp, so
+	// pass them in %esi and %ebp.  That leaves no register for a5.
+	// sysexit clobbers %ecx and %edx on the way back.
+	if (syscall_use_sysenter && a5 == 0) {
+		asm volatile("pushl %%ebp\n"
+			     "movl %%esp, %%ebp\n"
+			     "leal 1f, %%esi\n"
+			     "sysenter\n"
+			     "1: popl %%ebp\n"
+			     : "=a" (ret), "+d" (a1), "+c" (a2)
+			     : "a" (num),
+			       "b" (a3),
+			       "D" (a4)
+			     : "esi", "cc", "memory");
+
+		if(check && ret > 0)
+			panic("syscall %d returned %d (> 0)", num, ret);
+
+		return ret;
+	}
+
 	// Generic system call: pass system call number in AX,
 	// up to five parameters in DX, CX, BX, DI, SI.
 	// Interrupt kernel with T_SYSCALL.
@@ -55,10 +82,11 @@ sys_env_destroy(envid_t envid)
 	return syscall(SYS_env_destroy, 1, envid, 0, 0, 0, 0);
 }
 
+// Read from our identity page rather than trapping.
 envid_t
 sys_getenvid(void)
 {
-	 return syscall(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	return ((const volatile struct VdsoEnv *) UVDSO_ENV)->ve_id;
 }
 
 void
@@ -114,13 +142,80 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 int
 sys_ipc_recv(void *dstva)
 {
-	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 1, 0, 0, 0);
+}
+
+int
+sys_ipc_try_send_range(envid_t envid, uint32_t value, void *srcva, size_t npages, int perm)
+{
+	return syscall(SYS_ipc_try_send_range, 0, envid, value, (uint32_t) srcva, npages, perm);
+}
+
+int
+sys_ipc_recv_range(void *dstva, size_t npages)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, npages, 0, 0, 0);
+}
+
+// Like sys_ipc_recv, but give up with -E_TIMEOUT once sys_time_usec()
+// reaches 'deadline'.
+int
+sys_ipc_recv_until(void *dstva, uint64_t deadline)
+{
+	return syscall(SYS_ipc_recv, 0, (uint32_t)dstva, 1,
+		       (uint32_t)deadline, (uint32_t)(deadline >> 32), 0);
+}
+
+// Computed from the TSC and the calibration in the vDSO page,
+// rather than trapping.
+uint64_t
+sys_time_usec(void)
+{
+	const volatile struct Vdso *vd = (const volatile struct Vdso *) UVDSO;
+
+	return (read_tsc() - vd->vd_tsc_boot) * 1000 / vd->vd_tsc_khz;
 }
 
 unsigned int
 sys_time_msec(void)
 {
-	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
+	return sys_time_usec() / 1000;
+}
+
+int
+sys_sleep_until(uint64_t deadline)
+{
+	return syscall(SYS_sleep_until, 0, (uint32_t)deadline, (uint32_t)(deadline >> 32), 0, 0, 0);
+}
+
+int
+sys_ktrace(uint32_t code, uint32_t arg)
+{
+	return syscall(SYS_ktrace, 0, code, arg, 0, 0, 0);
+}
+
+int
+sys_sysstat(struct SysStat *stats)
+{
+	return syscall(SYS_sysstat, 0, (uint32_t) stats, 0, 0, 0, 0);
+}
+
+int
+sys_ide_bmbase(void)
+{
+	return syscall(SYS_ide_bmbase, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_page_paddr(void *va)
+{
+	return syscall(SYS_page_paddr, 0, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_prof_read(envid_t envid, struct ProfSample *samples, size_t n)
+{
+	return syscall(SYS_prof_read, 0, envid, (uint32_t) samples, n, 0, 0);
 }
 
 int
@@ -133,4 +228,64 @@ int
 sys_rx_pkt(char *buf)
 {
 	return syscall(SYS_rx_pkt, 0, (uint32_t) buf, 0, 0, 0, 0);
-}
\ No newline at end of file
+}
+
+uint32_t
+sys_notify_wait(uint32_t mask, unsigned int timeout)
+{
+	return (uint32_t) syscall(SYS_notify_wait, 0, mask, timeout, 0, 0, 0);
+}
+
+int
+sys_notify_signal(envid_t envid, uint32_t bits)
+{
+	return syscall(SYS_notify_signal, 1, envid, bits, 0, 0, 0);
+}
+
+int
+sys_notify_bind(uint32_t bits)
+{
+	return syscall(SYS_notify_bind, 1, bits, 0, 0, 0, 0);
+}
+
+int32_t
+sys_ep_create(void)
+{
+	return syscall(SYS_ep_create, 0, 0, 0, 0, 0, 0);
+}
+
+int32_t
+sys_ep_call(int32_t epid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ep_call, 0, epid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+int
+sys_ep_recv(int32_t epid, void *dstva)
+{
+	return syscall(SYS_ep_recv, 1, epid, (uint32_t) dstva, 0, 0, 0);
+}
+
+int
+sys_ep_try_recv(int32_t epid, void *dstva)
+{
+	return syscall(SYS_ep_recv, 0, epid, (uint32_t) dstva, 1, 0, 0);
+}
+
+int
+sys_ep_reply(envid_t envid, int32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ep_reply, 1, envid, value, (uint32_t) srcva, perm, 0);
+}
+
+int
+sys_null(void)
+{
+	return syscall(SYS_null, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_sysring_enter(struct Sysring *ring)
+{
+	return syscall(SYS_sysring_enter, 0, (uint32_t) ring, 0, 0, 0, 0);
+}
@@ -0,0 +1,74 @@
+// Batched system calls through a syscall ring.
+//
+// sysring_push() queues a system call instead of making it; the queue
+// is run by sysring_flush(), with one trap for up to SYSRING_SIZE calls.
+// Use it for long runs of calls whose results you don't need one at a
+// time, and flush before anything that depends on their effects.
+
+#include <inc/lib.h>
+
+static struct Sysring ring __attribute__((aligned(PGSIZE)));
+
+// First error returned by a queued call since the last sysring_flush().
+static int sysring_err;
+
+static void
+sysring_run(void)
+{
+	uint32_t i, head = ring.sr_head;
+	int r;
+
+	if (head == ring.sr_tail)
+		return;
+	if ((r = sys_sysring_enter(&ring)) < 0)
+		panic("sys_sysring_enter: %e", r);
+	if (r > 0 && sysring_err == 0)
+		for (i = head; i != ring.sr_head; i++)
+			if (ring.sr_ent[i % SYSRING_SIZE].se_ret < 0) {
+				sysring_err = ring.sr_ent[i % SYSRING_SIZE].se_ret;
+				break;
+			}
+	if (ring.sr_head != ring.sr_tail)
+		panic("sysring: ring page went away during a batch");
+}
+
+// Make sure the next 'n' pushes go into the same batch, so no user code
+// runs between them.
+void
+sysring_reserve(int n)
+{
+	assert(n <= SYSRING_SIZE);
+	if (ring.sr_tail - ring.sr_head > SYSRING_SIZE - n)
+		sysring_run();
+}
+
+// Queue system call 'num'.  Runs the queue first if it is full.
+void
+sysring_push(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+	     uint32_t a4, uint32_t a5)
+{
+	struct SysringEntry *se;
+
+	sysring_reserve(1);
+	se = &ring.sr_ent[ring.sr_tail % SYSRING_SIZE];
+	se->se_num = num;
+	se->se_args[0] = a1;
+	se->se_args[1] = a2;
+	se->se_args[2] = a3;
+	se->se_args[3] = a4;
+	se->se_args[4] = a5;
+	ring.sr_tail++;
+}
+
+// Run every queued call.  Returns 0 if all calls queued since the last
+// flush succeeded, otherwise the first error.
+int
+sysring_flush(void)
+{
+	int r;
+
+	sysring_run();
+	r = sysring_err;
+	sysring_err = 0;
+	return r;
+}
@@ -0,0 +1,34 @@
+#include "ns.h"
+
+void
+timer(envid_t ns_envid, uint32_t initial_to) {
+	int r;
+	uint64_t stop = sys_time_usec() + initial_to * 1000ULL;
+
+	binaryname = "ns_timer";
+
+	while (1) {
+		// Sleep in the kernel's timer wheel rather than spinning
+		// on sys_time_msec() and sys_yield().  When the whole
+		// network stack is blocked like this, sched_halt sees our
+		// pending timeout and idles until the timer wakes us,
+		// rather than dropping into the monitor.
+		if ((r = sys_sleep_until(stop)) < 0)
+			panic("sys_sleep_until: %e", r);
+
+		ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
+
+		while (1) {
+			uint32_t to, whom;
+			to = ipc_recv((int32_t *) &whom, 0, 0);
+
+			if (whom != ns_envid) {
+				cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
+				continue;
+			}
+
+			stop = sys_time_usec() + to * 1000ULL;
+			break;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+// Block allocation benchmark: fill the disk to 90% with filler files,
+// then time creating NFILES one-block files spread over NDIRS
+// directories, so that every file costs at least one file_alloc_block().
+// The disk needs room for the files in its last 10%, so run it on a
+// file system image of at least 128MB.  There is no remove, so the
+// disk stays full afterwards; start from a fresh image each time.
+
+#include <inc/lib.h>
+
+#define NFILES		10000
+#define NDIRS		100
+#define FULL_PCT	90
+
+static char buf[BLKSIZE];
+
+static void
+stat_disk(struct BcStat *st)
+{
+	int r;
+
+	if ((r = bcstat(st)) < 0)
+		panic("bcstat: %e", r);
+}
+
+// Write filler files until no more than (100 - FULL_PCT)% of the disk
+// is free.
+static void
+fill(void)
+{
+	struct BcStat st;
+	char path[MAXPATHLEN];
+	uint32_t target, n;
+	int fd, r, i;
+
+	stat_disk(&st);
+	target = st.bs_disk_blocks / 100 * (100 - FULL_PCT);
+	cprintf("disk %u blocks, %u free, filling down to %u free\n",
+		st.bs_disk_blocks, st.bs_free_blocks, target);
+	if (target < NFILES + NFILES / (BLKSIZE / sizeof(struct File)) + NDIRS)
+		cprintf("warning: the disk is too small to hold %d more files\n", NFILES);
+
+	for (i = 0; st.bs_free_blocks > target; i++) {
+		snprintf(path, sizeof(path), "/allocbench.fill%d", i);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC)) < 0)
+			panic("open %s: %e", path, fd);
+		for (n = 0; n < MAXFILESIZE / BLKSIZE && st.bs_free_blocks > target; n++) {
+			if ((r = write(fd, buf, BLKSIZE)) != BLKSIZE)
+				panic("write %s: %e", path, r);
+			if (n % 64 == 63)
+				stat_disk(&st);
+		}
+		close(fd);
+		stat_disk(&st);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct BcStat st;
+	char path[MAXPATHLEN];
+	uint64_t t;
+	int fd, r, i;
+
+	binaryname = "allocbench";
+	fill();
+
+	for (i = 0; i < NDIRS; i++) {
+		snprintf(path, sizeof(path), "/allocbench.d%d", i);
+		if ((fd = open(path, O_RDONLY | O_CREAT | O_MKDIR)) < 0)
+			panic("mkdir %s: %e", path, fd);
+		close(fd);
+	}
+
+	t = sys_time_usec();
+	for (i = 0; i < NFILES; i++) {
+		snprintf(path, sizeof(path), "/allocbench.d%d/f%d", i % NDIRS, i);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL)) < 0)
+			panic("open %s: %e", path, fd);
+		if ((r = write(fd, buf, BLKSIZE)) != BLKSIZE)
+			panic("write %s: %e", path, r);
+		close(fd);
+	}
+	t = sys_time_usec() - t;
+
+	sync();
+	stat_disk(&st);
+	cprintf("created %d files in %u ms (%u us per file), %u blocks free\n",
+		NFILES, (uint32_t) (t / 1000), (uint32_t) (t / NFILES),
+		st.bs_free_blocks);
+}
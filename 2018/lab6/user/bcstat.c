@@ -0,0 +1,24 @@
+// Print the file server's block cache statistics.
+// Useful around a workload: bcstat; <workload>; bcstat
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	struct BcStat st;
+	int r;
+
+	binaryname = "bcstat";
+	if ((r = bcstat(&st)) < 0)
+		panic("bcstat: %e", r);
+
+	printf("resident %u/%u blocks\n", st.bs_resident, st.bs_maxblocks);
+	printf("hits %u misses %u evictions %u\n",
+	       st.bs_hits, st.bs_misses, st.bs_evictions);
+	printf("dirty %u, %u blocks written back in %u writes\n",
+	       st.bs_dirty, st.bs_writebacks, st.bs_writeruns);
+	printf("disk %u blocks, %u free\n", st.bs_disk_blocks, st.bs_free_blocks);
+	printf("read-ahead %u blocks, %u used, %u wasted\n",
+	       st.bs_ra_blocks, st.bs_ra_hits, st.bs_ra_waste);
+}
@@ -0,0 +1,67 @@
+// Directory lookup benchmark: create NENTS empty files in one
+// directory, then time opening NOPEN of them picked at random.
+// The directory alone takes NENTS / BLKFILES blocks (5MB), so run it
+// on an image of at least 2048 blocks.  There is no remove, so start
+// from a fresh image each time.
+
+#include <inc/lib.h>
+
+#define NENTS		20000
+#define NOPEN		2000
+#define DIR		"/dirbench"
+
+static uint32_t seed = 1;
+
+static uint32_t
+rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+void
+umain(int argc, char **argv)
+{
+	char path[MAXPATHLEN];
+	uint64_t t;
+	int fd, i;
+
+	binaryname = "dirbench";
+	if ((fd = open(DIR, O_RDONLY | O_CREAT | O_EXCL | O_MKDIR)) < 0)
+		panic("mkdir %s: %e", DIR, fd);
+	close(fd);
+
+	t = sys_time_usec();
+	for (i = 0; i < NENTS; i++) {
+		snprintf(path, sizeof(path), DIR "/f%d", i);
+		if ((fd = open(path, O_RDONLY | O_CREAT | O_EXCL)) < 0)
+			panic("create %s: %e", path, fd);
+		close(fd);
+	}
+	t = sys_time_usec() - t;
+	cprintf("created %d files in %u ms (%u us per file)\n",
+		NENTS, (uint32_t) (t / 1000), (uint32_t) (t / NENTS));
+
+	t = sys_time_usec();
+	for (i = 0; i < NOPEN; i++) {
+		snprintf(path, sizeof(path), DIR "/f%d", rand() % NENTS);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			panic("open %s: %e", path, fd);
+		close(fd);
+	}
+	t = sys_time_usec() - t;
+	cprintf("opened %d random files in %u ms (%u us per open)\n",
+		NOPEN, (uint32_t) (t / 1000), (uint32_t) (t / NOPEN));
+
+	// And names that aren't there, which have to look at everything
+	// without an index
+	t = sys_time_usec();
+	for (i = 0; i < NOPEN; i++) {
+		snprintf(path, sizeof(path), DIR "/missing%d", i);
+		if ((fd = open(path, O_RDONLY)) != -E_NOT_FOUND)
+			panic("open %s: %e", path, fd);
+	}
+	t = sys_time_usec() - t;
+	cprintf("failed %d opens in %u ms (%u us per open)\n",
+		NOPEN, (uint32_t) (t / 1000), (uint32_t) (t / NOPEN));
+}
@@ -0,0 +1,102 @@
+// Report how fragmented the files under a directory are: for each
+// regular file, its blocks, the extents (runs of blocks contiguous
+// on disk) they make up, and the average extent length.
+// Usage: fragreport [-q] [dir]; -q prints only the totals.
+
+#include <inc/lib.h>
+
+static int quiet;
+static uint32_t total_files, total_blocks, total_extents;
+
+// Print n/d with two decimals.
+static void
+print_ratio(uint32_t n, uint32_t d)
+{
+	uint32_t x = d ? n * 100 / d : 0;
+
+	printf("%u.%02u", x / 100, x % 100);
+}
+
+static void
+report_file(const char *path)
+{
+	uint32_t nblocks, nextents;
+	int fd, r;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		panic("open %s: %e", path, fd);
+	if ((r = fextents(fd, &nblocks, &nextents)) < 0)
+		panic("fextents %s: %e", path, r);
+	close(fd);
+
+	if (nblocks == 0)
+		return;
+	total_files++;
+	total_blocks += nblocks;
+	total_extents += nextents;
+	if (!quiet) {
+		printf("%6u blocks %5u extents  avg ", nblocks, nextents);
+		print_ratio(nblocks, nextents);
+		printf("  %s\n", path);
+	}
+}
+
+static void
+report_dir(const char *path)
+{
+	char sub[MAXPATHLEN];
+	struct File f;
+	int fd, n;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		panic("open %s: %e", path, fd);
+	while ((n = readn(fd, &f, sizeof f)) == sizeof f) {
+		if (!f.f_name[0])
+			continue;
+		snprintf(sub, sizeof(sub), "%s%s%s", path,
+			 path[strlen(path) - 1] == '/' ? "" : "/", f.f_name);
+		if (f.f_type == FTYPE_DIR)
+			report_dir(sub);
+		else
+			report_file(sub);
+	}
+	if (n < 0)
+		panic("read %s: %e", path, n);
+	close(fd);
+}
+
+void
+usage(void)
+{
+	printf("usage: fragreport [-q] [dir]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Argstate args;
+	int i;
+
+	binaryname = "fragreport";
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		switch (i) {
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage();
+		}
+
+	if (argc > 2)
+		usage();
+	report_dir(argc == 2 ? argv[1] : "/");
+
+	printf("%u files, %u blocks, %u extents, average extent ",
+	       total_files, total_blocks, total_extents);
+	print_ratio(total_blocks, total_extents);
+	printf(" blocks, ");
+	print_ratio(total_extents, total_files);
+	printf(" extents per file\n");
+}
@@ -0,0 +1,69 @@
+// Print the hottest user eips recorded by the kernel's sampling
+// profiler (turn it on with the 'prof on' monitor command).
+// Usage: profdump [envid]
+// Addresses can be symbolized with addr2line on obj/user/<prog>.
+
+#include <inc/lib.h>
+
+#define NSAMPLES	8192
+#define NEIPS		256
+#define NTOP		20
+
+struct EipCount {
+	envid_t ec_env;
+	uintptr_t ec_eip;
+	uint32_t ec_count;
+};
+
+static struct ProfSample samples[NSAMPLES];
+static struct EipCount eips[NEIPS];
+
+void
+umain(int argc, char **argv)
+{
+	envid_t envid = 0;
+	int n, i, j, neip = 0, dropped = 0;
+
+	binaryname = "profdump";
+	if (argc > 2) {
+		printf("usage: profdump [envid]\n");
+		exit();
+	}
+	if (argc == 2)
+		envid = strtol(argv[1], 0, 16);
+
+	if ((n = sys_prof_read(envid, samples, NSAMPLES)) < 0)
+		panic("sys_prof_read: %e", n);
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < neip; j++)
+			if (eips[j].ec_eip == samples[i].ps_eip &&
+			    eips[j].ec_env == samples[i].ps_env)
+				break;
+		if (j == neip) {
+			if (neip == NEIPS) {
+				dropped++;
+				continue;
+			}
+			eips[neip].ec_env = samples[i].ps_env;
+			eips[neip].ec_eip = samples[i].ps_eip;
+			neip++;
+		}
+		eips[j].ec_count++;
+	}
+
+	// Insertion sort, most samples first
+	for (i = 1; i < neip; i++) {
+		struct EipCount e = eips[i];
+		for (j = i; j > 0 && eips[j - 1].ec_count < e.ec_count; j--)
+			eips[j] = eips[j - 1];
+		eips[j] = e;
+	}
+
+	printf("%d user samples\n", n);
+	printf("  count      env       eip\n");
+	for (i = 0; i < neip && i < NTOP; i++)
+		printf("  %5d  %08x  %08x\n", eips[i].ec_count, eips[i].ec_env, eips[i].ec_eip);
+	if (dropped)
+		printf("  %5d  (not counted, too many distinct eips)\n", dropped);
+}
@@ -0,0 +1,40 @@
+// Test granting several pages with a single IPC.
+// The child declares a window smaller than what the parent sends,
+// so only the first NRECV pages should show up.
+
+#include <inc/lib.h>
+
+#define NSEND		8
+#define NRECV		4
+
+#define TEMP_ADDR	((char*)0xa00000)
+#define TEMP_ADDR_CHILD	((char*)0xb00000)
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who;
+	size_t npages;
+	int i;
+
+	if ((who = fork()) == 0) {
+		// Child
+		ipc_recv_range(&who, TEMP_ADDR_CHILD, NRECV, 0, &npages);
+		cprintf("%x sent %d pages\n", who, npages);
+		if (npages != NRECV)
+			panic("expected %d pages, got %d", NRECV, npages);
+		for (i = 0; i < npages; i++)
+			if (TEMP_ADDR_CHILD[i * PGSIZE] != 'a' + i)
+				panic("page %d has wrong contents", i);
+		cprintf("child received correct pages\n");
+		return;
+	}
+
+	// Parent
+	for (i = 0; i < NSEND; i++) {
+		sys_page_alloc(0, TEMP_ADDR + i * PGSIZE, PTE_P | PTE_W | PTE_U);
+		TEMP_ADDR[i * PGSIZE] = 'a' + i;
+	}
+	ipc_send_range(who, 0, TEMP_ADDR, NSEND, PTE_P | PTE_U);
+	wait(who);
+}
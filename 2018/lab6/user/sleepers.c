@@ -0,0 +1,47 @@
+// Test the kernel timer wheel: many environments sleep for different
+// lengths of time, some long enough to be filed in the upper levels of
+// the wheel, and each checks that it wasn't woken early.
+
+#include <inc/lib.h>
+
+#define NSLEEPERS	32
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NSLEEPERS];
+	uint64_t start, deadline, late;
+	int i, r;
+
+	for (i = 0; i < NSLEEPERS; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0)
+			break;
+	}
+	if (i == NSLEEPERS) {
+		for (i = 0; i < NSLEEPERS; i++)
+			wait(kids[i]);
+		cprintf("sleepers: OK\n");
+		return;
+	}
+
+	// Spread the deadlines from under 1ms to about 2s.
+	start = sys_time_usec();
+	deadline = start + 300 + (uint64_t) i * i * 2000;
+	if ((r = sys_sleep_until(deadline)) < 0)
+		panic("sys_sleep_until: %e", r);
+	if (sys_time_usec() < deadline)
+		panic("sleeper %d woke up %u us early", i,
+		      (uint32_t) (deadline - sys_time_usec()));
+	late = sys_time_usec() - deadline;
+	cprintf("sleeper %d: slept %u us, %u us late\n", i,
+		(uint32_t) (deadline - start), (uint32_t) late);
+
+	// A receive with nobody sending has to time out.
+	deadline = sys_time_usec() + 5000;
+	if ((r = ipc_recv_until(0, 0, 0, deadline)) != -E_TIMEOUT)
+		panic("ipc_recv_until returned %d, not a timeout", r);
+	if (sys_time_usec() < deadline)
+		panic("ipc_recv_until timed out early");
+}
@@ -0,0 +1,37 @@
+// Compare the cost of a null system call through int $T_SYSCALL
+// and through sysenter/sysexit.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCALLS	100000
+
+static uint64_t
+bench(bool use_sysenter)
+{
+	uint64_t start;
+	int i;
+
+	syscall_use_sysenter = use_sysenter;
+	start = read_tsc();
+	for (i = 0; i < NCALLS; i++)
+		sys_null();
+	return read_tsc() - start;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t intcyc, fastcyc;
+
+	// Warm up the caches and TLB first.
+	bench(0);
+	bench(1);
+
+	intcyc = bench(0) / NCALLS;
+	fastcyc = bench(1) / NCALLS;
+	syscall_use_sysenter = 1;
+
+	cprintf("null syscall: int %u cycles, sysenter %u cycles\n",
+		intcyc, fastcyc);
+}
@@ -0,0 +1,27 @@
+// Print per-system-call statistics, like the 'sysstat' monitor command.
+// Useful around a workload: sysstat; <workload>; sysstat
+
+#include <inc/lib.h>
+
+static struct SysStat stats[NSYSCALLS];
+
+void
+umain(int argc, char **argv)
+{
+	int n, i;
+
+	binaryname = "sysstat";
+	if ((n = sys_sysstat(stats)) < 0)
+		panic("sys_sysstat: %e", n);
+
+	printf("num      calls  blocked   errors   avg cycles   max cycles\n");
+	for (i = 0; i < n; i++) {
+		if (!stats[i].ss_calls)
+			continue;
+		printf("%3d %10u %8u %8u %12u %12u\n", i, stats[i].ss_calls,
+		       stats[i].ss_calls - stats[i].ss_timed, stats[i].ss_errors,
+		       stats[i].ss_timed ?
+		       (uint32_t) (stats[i].ss_cycles / stats[i].ss_timed) : 0,
+		       (uint32_t) stats[i].ss_max);
+	}
+}